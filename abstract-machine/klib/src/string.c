@@ -4,6 +4,21 @@
 
 #if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
 
+#if defined(__NEMU_HOSTCALL__) && defined(__riscv)
+// NEMU does the operation on the host for a custom-0 instruction with funct3
+// selecting it, see hostcall_mem() in NEMU. The result in a0 is 0 if NEMU
+// can not do it, e.g. for MMIO, then it is done by the loops here.
+#define nemu_hostcall(funct3, dst, src, n) ({ \
+  register uintptr_t a0 asm("a0") = (uintptr_t)(dst); \
+  register uintptr_t a1 asm("a1") = (uintptr_t)(src); \
+  register uintptr_t a2 asm("a2") = (uintptr_t)(n); \
+  asm volatile (".insn r CUSTOM_0, " #funct3 ", 0, zero, zero, zero" \
+      : "+r"(a0) : "r"(a1), "r"(a2) : "memory"); \
+  a0; })
+#else
+#define nemu_hostcall(funct3, dst, src, n) 0
+#endif
+
 size_t strlen(const char *s) {
   panic("Not implemented");
 }
@@ -29,15 +44,39 @@ int strncmp(const char *s1, const char *s2, size_t n) {
 }
 
 void *memset(void *s, int c, size_t n) {
-  panic("Not implemented");
+  if (nemu_hostcall(1, s, c, n)) return s;
+  unsigned char *p = s;
+  if (((uintptr_t)p & (sizeof(uintptr_t) - 1)) == 0) {
+    uintptr_t w = (unsigned char)c * (UINTPTR_MAX / 0xff);
+    for (; n >= sizeof(w); n -= sizeof(w), p += sizeof(w)) *(uintptr_t *)p = w;
+  }
+  while (n --) *p ++ = c;
+  return s;
+}
+
+// also correct for overlapping buffers with dst below src
+static void copy_forward(unsigned char *d, const unsigned char *s, size_t n) {
+  if ((((uintptr_t)d | (uintptr_t)s) & (sizeof(uintptr_t) - 1)) == 0) {
+    for (; n >= sizeof(uintptr_t); n -= sizeof(uintptr_t), d += sizeof(uintptr_t), s += sizeof(uintptr_t)) {
+      *(uintptr_t *)d = *(const uintptr_t *)s;
+    }
+  }
+  while (n --) *d ++ = *s ++;
 }
 
 void *memmove(void *dst, const void *src, size_t n) {
-  panic("Not implemented");
+  if (nemu_hostcall(2, dst, src, n)) return dst;
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  if (d <= s || d >= s + n) copy_forward(d, s, n);
+  else while (n --) d[n] = s[n];
+  return dst;
 }
 
 void *memcpy(void *out, const void *in, size_t n) {
-  panic("Not implemented");
+  if (nemu_hostcall(0, out, in, n)) return out;
+  copy_forward(out, in, n);
+  return out;
 }
 
 int memcmp(const void *s1, const void *s2, size_t n) {
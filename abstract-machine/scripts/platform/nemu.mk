@@ -8,6 +8,10 @@ AM_SRCS := platform/nemu/trm.c \
            platform/nemu/mpe.c
 
 CFLAGS    += -fdata-sections -ffunction-sections
+# let NEMU do memcpy()/memset()/memmove() in klib on the host, `make HOSTCALL=1'
+ifeq ($(HOSTCALL),1)
+CFLAGS    += -D__NEMU_HOSTCALL__
+endif
 CFLAGS    += -I$(AM_HOME)/am/src/platform/nemu/include
 LDSCRIPTS += $(AM_HOME)/scripts/linker.ld
 LDFLAGS   += --defsym=_pmem_start=0x80000000 --defsym=_entry_offset=0x0
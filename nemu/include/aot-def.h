@@ -0,0 +1,68 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __AOT_DEF_H__
+#define __AOT_DEF_H__
+
+// Interface between NEMU and the shared objects generated by tools/aot.
+// This header is also included by the generated code, so it should not
+// depend on the configuration of NEMU. Only riscv32 guests are supported.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AOT_VERSION 1
+
+// provided by NEMU in aot_init()
+typedef struct {
+  uint32_t *gpr;                // the 32 general-purpose registers
+  uint32_t *pc;
+  uint8_t *pmem;                // host address of the guest physical memory
+  uint32_t pmem_base, pmem_size;
+  const uint8_t *code_page;     // one byte for each pmem page, non-zero for code pages
+  int page_shift;
+  volatile bool *exit_request;  // translated code returns to NEMU when it is set
+  uint32_t (*read)(uint32_t addr, int len);
+  void (*write)(uint32_t addr, int len, uint32_t data);
+} AOTContext;
+
+// exported by the shared object as `aot_info'
+typedef struct {
+  int version;
+  uint32_t base, size;          // the image which the code is translated from
+  uint64_t checksum;            // aot_checksum() of the image
+  int nr_block;
+  const uint32_t *block_pc;     // start and number of instructions of each block
+  const uint32_t *block_len;
+} AOTInfo;
+
+// other functions exported by the shared object:
+//   void aot_init(const AOTContext *ctx);
+//   // execute at most `n' instructions from *ctx->pc, and return the number
+//   // of executed ones, which is 0 if *ctx->pc does not start a translated block
+//   uint64_t aot_exec(uint64_t n);
+//   // disable the blocks overwritten by a store, and set *ctx->exit_request
+//   void aot_invalidate(uint32_t addr, int len);
+
+// FNV-1a
+static inline uint64_t aot_checksum(const uint8_t *p, uint32_t size) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (uint32_t i = 0; i < size; i ++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+#endif
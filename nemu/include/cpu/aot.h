@@ -0,0 +1,30 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_AOT_H__
+#define __CPU_AOT_H__
+
+#include <common.h>
+
+// Code translated ahead of time by tools/aot, see include/aot-def.h.
+void init_aot(const char *so_file);
+// Run translated code from cpu.pc for at most `n' instructions, and
+// return the number of executed ones, which is 0 if cpu.pc is not translated.
+uint64_t aot_run(uint64_t n);
+// called by the memory system when a code page is written
+void aot_invalidate_code(paddr_t addr, int len);
+void aot_statistic();
+
+#endif
@@ -19,10 +19,29 @@
 #include <common.h>
 
 void cpu_exec(uint64_t n);
+// Ask the main loop to handle events after `nr_inst' more guest instructions.
+// With 0, it stops after the current instruction.
+void cpu_post_deadline(uint64_t nr_inst);
+// Ask the main loop to check interrupts at the next block boundary.
+// This is async-signal-safe.
+void cpu_notify_intr();
+// Switch between the instrumented loop (itrace, difftest) and the fast one.
+void cpu_set_trace(bool enable);
+
+// Raise the exception `NO' in the middle of the instruction at cpu.pc. The
+// instruction is left without being executed, and the CPU continues at the
+// trap handler. Return only if no guest instruction is being executed, e.g.
+// for memory accesses of the monitor.
+void cpu_raise_exception(word_t NO);
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
 
+// Bulk memory operations done on the host for the guest. Return false
+// if the operands are not plain pmem, then the guest should do it itself.
+enum { HOSTCALL_MEMCPY, HOSTCALL_MEMSET, HOSTCALL_MEMMOVE };
+bool hostcall_mem(int op, vaddr_t dst, word_t src, word_t n);
+
 #define NEMUTRAP(thispc, code) set_nemu_state(NEMU_END, thispc, code)
 #define INV(thispc) invalid_inst(thispc)
 
@@ -86,17 +86,73 @@ finish:
 }
 
 
+// --- decode table ---
+// The patterns of an INSTPAT block are collected into a table when the block
+// is executed for the first time. The table is indexed by the instruction bits
+// which best distinguish the patterns, and each entry lists the patterns which
+// may match in their original order. Decoding an instruction then only checks
+// a few patterns instead of all of them.
+
+#define INSTPAT_MAX_FIELD 8
+
+typedef struct {
+  uint64_t key, mask; // the pattern matches if (inst & mask) == key
+  const void *label;
+} InstPat;
+
+typedef struct InstPatTable {
+  const char *loc; // source location of the INSTPAT block
+  bool ready;
+  int nr_pat, max_pat, width, nr_index_bit;
+  InstPat *pat;
+  const void *nomatch;
+  // the index is gathered from bit fields of the instruction
+  int nr_field;
+  struct { uint8_t lsb, len, pos; } field[INSTPAT_MAX_FIELD];
+  uint32_t *bucket; // start of the candidate list in `cand' for each index
+  int16_t *cand;    // candidate lists, each of them is terminated by -1
+  struct InstPatTable *next;
+} InstPatTable;
+
+void instpat_add(InstPatTable *t, const char *pattern, int len, const void *label);
+void instpat_build(InstPatTable *t, const void *nomatch);
+void instpat_bench();
+
+static inline const void* instpat_lookup(InstPatTable *t, uint64_t inst) {
+  uint32_t idx = 0;
+  for (int i = 0; i < t->nr_field; i ++) {
+    idx |= ((inst >> t->field[i].lsb) & ((1u << t->field[i].len) - 1)) << t->field[i].pos;
+  }
+  for (const int16_t *c = t->cand + t->bucket[idx]; *c >= 0; c ++) {
+    if ((inst & t->pat[*c].mask) == t->pat[*c].key) return t->pat[*c].label;
+  }
+  return t->nomatch;
+}
+
 // --- pattern matching wrappers for decode ---
 #define INSTPAT(pattern, ...) do { \
-  uint64_t key, mask, shift; \
-  pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
-  if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
-    INSTPAT_MATCH(s, ##__VA_ARGS__); \
-    goto *(__instpat_end); \
-  } \
+  instpat_add(&__instpat_table, pattern, STRLEN(pattern), &&concat(__instpat_match_, __LINE__)); \
+  break; \
+concat(__instpat_match_, __LINE__): \
+  INSTPAT_MATCH(s, ##__VA_ARGS__); \
+  goto *(__instpat_end); \
 } while (0)
 
-#define INSTPAT_START(name) { const void ** __instpat_end = &&concat(__instpat_end_, name);
-#define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
+// the table and the end label of an INSTPAT block
+#define INSTPAT_DECLARE(name) \
+  static InstPatTable __instpat_table = { .loc = __FILE__ ":" str(__LINE__) }; \
+  static const void * const __instpat_end = &&concat(__instpat_end_, name);
+#define INSTPAT_LOOKUP() \
+  if (likely(__instpat_table.ready)) goto *instpat_lookup(&__instpat_table, INSTPAT_INST(s));
+
+#define INSTPAT_START(name) { INSTPAT_DECLARE(name) INSTPAT_LOOKUP()
+// A decoder which jumps into the block, e.g. to a cached execute body, should
+// not skip the declarations. It declares them with INSTPAT_DECLARE() before
+// the jump, and starts the block with INSTPAT_BEGIN() instead.
+#define INSTPAT_BEGIN() { INSTPAT_LOOKUP()
+#define INSTPAT_END(name) \
+  instpat_build(&__instpat_table, __instpat_end); \
+  goto *instpat_lookup(&__instpat_table, INSTPAT_INST(s)); \
+  concat(__instpat_end_, name): ; }
 
 #endif
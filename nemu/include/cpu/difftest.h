@@ -23,16 +23,20 @@
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
-void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_step(vaddr_t pc, vaddr_t npc, int nr_inst);
 void difftest_detach();
 void difftest_attach();
+void difftest_intr(word_t NO);
+void difftest_sync_mem(paddr_t addr, size_t n);
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
-static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_step(vaddr_t pc, vaddr_t npc, int nr_inst) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_intr(word_t NO) {}
+static inline void difftest_sync_mem(paddr_t addr, size_t n) {}
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
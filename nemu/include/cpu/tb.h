@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_TB_H__
+#define __CPU_TB_H__
+
+#include <cpu/decode.h>
+
+// A translation block is a sequence of pre-decoded instructions. It spans
+// the fall-through path of conditional branches and the target of direct
+// jumps, and ends at indirect jumps and system instructions.
+typedef struct TB {
+  vaddr_t pc;
+  int nr_inst;
+  Decode *inst;
+  struct TB *succ[2]; // recently taken successors, for block chaining
+  struct TB *next;    // next block in the same hash bucket
+#ifdef CONFIG_ENGINE_JIT
+  void *code;         // entry of the compiled code, NULL if not compiled
+  uint32_t nr_exec;
+#endif
+} TB;
+
+// set when the current block should stop at the next instruction boundary
+extern bool tb_exit_request;
+
+TB* tb_find(TB *prev, vaddr_t pc);
+int tb_exec(TB *tb, int n);
+void tb_invalidate(paddr_t paddr, int len);
+void tb_flush();
+void tb_statistic();
+
+#ifdef CONFIG_ENGINE_JIT
+void jit_compile(TB *tb);
+int jit_exec(TB *tb);
+void jit_flush();
+void jit_statistic();
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+#define TIMER_HZ 60
+
+typedef void (*event_handler_t) ();
+
+// Devices schedule their periodic and delayed work as events on the
+// virtual time in us. The CPU leaves its loop only when the earliest
+// event is due.
+
+// Add an event which calls `handler' every `period' us, or only when
+// scheduled by event_schedule() if `period' is 0. Return its id.
+int event_add(const char *name, uint64_t period, event_handler_t handler);
+// call the handler of event `id' after `delay' us, instead of the pending call
+void event_schedule(int id, uint64_t delay);
+void event_cancel(int id);
+// the virtual time in us, which is the host time or derived from the
+// number of guest instructions with CONFIG_TIME_ICOUNT
+uint64_t event_now();
+// call the handlers of the due events, then let the CPU return at the next one
+void event_run();
+
+#endif
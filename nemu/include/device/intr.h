@@ -13,12 +13,16 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#ifndef __DEVICE_ALARM_H__
-#define __DEVICE_ALARM_H__
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
 
-#define TIMER_HZ 60
+#include <common.h>
 
-typedef void (*alarm_handler_t) ();
-void add_alarm_handle(alarm_handler_t h);
+// interrupt request lines of devices, mapped to interrupt causes by the ISA
+enum { IRQ_TIMER, IRQ_KEYBOARD, NR_IRQ };
+
+void dev_raise_intr(int irq);
+void dev_ack_intr(int irq);
+uint32_t dev_intr_pending();
 
 #endif
@@ -36,6 +36,11 @@ word_t isa_reg_str2val(const char *name, bool *success);
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+// how an instruction ends a translation block, returned by isa_decode_once()
+enum { TB_END_NONE, TB_END_BRANCH, TB_END_JUMP, TB_END_INDIRECT, TB_END_STOP };
+int isa_decode_once(struct Decode *s);
+int isa_exec_block(struct Decode *s, int n);
+void isa_fuse_block(struct Decode *s, int n);
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
@@ -45,6 +50,9 @@ enum { MEM_RET_OK, MEM_RET_FAIL, MEM_RET_CROSS_PAGE };
 int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
+// set up the page fault of an access of `type' to `vaddr', e.g. the trap
+// value, and return its exception number for cpu_raise_exception()
+word_t isa_page_fault(vaddr_t vaddr, int type);
 
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
@@ -0,0 +1,29 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_CACHE_H__
+#define __MEMORY_CACHE_H__
+
+#include <common.h>
+
+// Feed an access at the physical address `addr' to the cache simulator.
+// `type' is one of MEM_TYPE_*. Device accesses are ignored.
+void cache_access(paddr_t addr, int len, int type);
+// Accesses are not fed while it is set, e.g. those made by the monitor.
+extern bool cache_bypass;
+void init_cache();
+void cache_statistic();
+
+#endif
@@ -31,6 +31,51 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* make pmem in [addr, addr + len) ready to be accessed by system calls,
+ * since pmem may be populated lazily on page faults */
+void pmem_populate(paddr_t addr, uint64_t len);
+
+/* load [off, off + len) of the file `fd' to pmem at `addr', sharing
+ * the page cache copy-on-write where the alignment allows */
+void pmem_load_file(paddr_t addr, int fd, uint64_t off, uint64_t len);
+
+/* invalidate the code cached from [addr, addr + len) of pmem, which is
+ * written by the host directly */
+void pmem_check_code_write(paddr_t addr, uint64_t len);
+
+#ifdef CONFIG_PMEM_SHARE
+/* copy the CPU state to the header of the shared pmem file */
+void pmem_share_update();
+#endif
+
+#ifdef CONFIG_PMEM_CODE_PAGE
+/* mark the pmem pages holding [paddr, paddr + len) as code pages, stores
+ * into code pages invalidate the decoded instructions they overwrite */
+void pmem_mark_code_page(paddr_t paddr, int len);
+// one byte for each pmem page, non-zero for code pages
+extern uint8_t pmem_code_page[];
+#endif
+
+/* let accesses to the guest physical pages covered by [addr, addr + len)
+ * read (and write if `writable') the host memory at `host' directly */
+void paddr_map_host(paddr_t addr, uint64_t len, uint8_t *host, bool writable);
+/* the host address of `addr' if it can be accessed directly, or NULL */
+uint8_t* paddr_host(paddr_t addr, bool is_write);
+
+#ifdef CONFIG_MEM_REGIONS_ENABLE
+/* a memory region besides pmem, see CONFIG_MEM_REGIONS */
+typedef struct {
+  const char *name;
+  paddr_t base;
+  uint64_t size;
+  uint8_t *host;
+  bool readonly;
+} MemRegion;
+
+/* the memory region holding `addr', or NULL */
+MemRegion* mem_region(paddr_t addr);
+#endif
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
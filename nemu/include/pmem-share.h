@@ -0,0 +1,50 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __PMEM_SHARE_H__
+#define __PMEM_SHARE_H__
+
+// Layout of the file exporting pmem, see CONFIG_PMEM_SHARE. This header is
+// also included by external tools, so it should not depend on the
+// configuration of NEMU.
+//
+// The file starts with a PmemShareHeader, and pmem follows at `pmem_offset'.
+// The state fields are updated by NEMU while the guest is running. A reader
+// gets a consistent copy of them by retrying until `seq' is even and does
+// not change across the copy.
+
+#include <stdint.h>
+
+#define PMEM_SHARE_MAGIC   0x4d454d50554d454eull // "NEMUPMEM"
+#define PMEM_SHARE_VERSION 1
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t cpu_size;      // bytes of `cpu' in use
+  uint64_t pmem_offset;   // offset of pmem in the file
+  uint64_t pmem_base, pmem_size;
+  char isa[16];           // e.g. "riscv32"
+
+  // state of the guest
+  uint64_t seq;           // odd while the fields below are being updated
+  uint64_t nr_guest_inst;
+  uint32_t state;         // NEMU_RUNNING, NEMU_STOP, ... in utils.h
+  uint32_t halt_ret;
+  uint64_t pc;
+  uint8_t cpu[1024];      // CPU_state of the guest ISA, see isa-def.h
+} PmemShareHeader;
+
+#endif
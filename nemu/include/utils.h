@@ -34,6 +34,12 @@ extern NEMUState nemu_state;
 
 uint64_t get_time();
 
+// ----------- elf -----------
+
+// symbols of the ELF image, if it is given
+bool elf_symbol_addr(const char *name, vaddr_t *addr);
+const char* elf_symbol_name(vaddr_t addr, vaddr_t *offset);
+
 // ----------- log -----------
 
 #define ANSI_FG_BLACK   "\33[1;30m"
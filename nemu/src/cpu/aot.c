@@ -0,0 +1,102 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/aot.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <aot-def.h>
+#include <dlfcn.h>
+
+#ifdef CONFIG_AOT
+
+static volatile bool aot_exit_request = false;
+static uint64_t (*aot_exec)(uint64_t n) = NULL;
+static void (*aot_invalidate)(uint32_t addr, int len) = NULL;
+// one bit for each pmem word, set if a translated block starts there
+static uint32_t *entry_map = NULL;
+static uint64_t nr_aot_inst = 0, nr_aot_run = 0;
+
+#define entry_word(pc) (((pc) - CONFIG_MBASE) >> 2)
+
+void init_aot(const char *so_file) {
+  if (so_file == NULL) return;
+
+  void *handle = dlopen(so_file, RTLD_NOW);
+  Assert(handle, "Can not load %s: %s", so_file, dlerror());
+  const AOTInfo *info = dlsym(handle, "aot_info");
+  void (*init)(const AOTContext *ctx) = dlsym(handle, "aot_init");
+  aot_exec = dlsym(handle, "aot_exec");
+  aot_invalidate = dlsym(handle, "aot_invalidate");
+  Assert(info && init && aot_exec && aot_invalidate, "%s is not generated by tools/aot", so_file);
+  Assert(info->version == AOT_VERSION, "%s is generated by another version of tools/aot", so_file);
+
+  // the translated code is only valid for the image it is translated from
+  if (!in_pmem(info->base) || !in_pmem(info->base + info->size - 1) ||
+      aot_checksum(guest_to_host(info->base), info->size) != info->checksum) {
+    Log("AOT: %s is not translated from the loaded image, ignored", so_file);
+    aot_exec = NULL;
+    dlclose(handle);
+    return;
+  }
+
+  entry_map = calloc(CONFIG_MSIZE / 4 / 32, sizeof(uint32_t));
+  assert(entry_map);
+  for (int i = 0; i < info->nr_block; i ++) {
+    paddr_t pc = info->block_pc[i], end = pc + info->block_len[i] * 4;
+    entry_map[entry_word(pc) / 32] |= 1u << (entry_word(pc) % 32);
+    // stores into translated code go through NEMU, which calls aot_invalidate_code()
+    for (paddr_t p = pc & ~(paddr_t)(PAGE_SIZE - 1); p < end; p += PAGE_SIZE) {
+      pmem_mark_code_page(p, 1);
+    }
+  }
+
+  AOTContext ctx = {
+    .gpr = cpu.gpr, .pc = &cpu.pc,
+    .pmem = guest_to_host(CONFIG_MBASE), .pmem_base = CONFIG_MBASE, .pmem_size = CONFIG_MSIZE,
+    .code_page = pmem_code_page, .page_shift = PAGE_SHIFT,
+    .exit_request = &aot_exit_request,
+    .read = vaddr_read, .write = vaddr_write,
+  };
+  init(&ctx);
+  Log("AOT: %s, %d blocks translated from [" FMT_PADDR ", " FMT_PADDR ")",
+      so_file, info->nr_block, info->base, info->base + info->size);
+}
+
+uint64_t aot_run(uint64_t n) {
+  // translated code accesses pmem with guest addresses directly
+  if (aot_exec == NULL || isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) != MMU_DIRECT ||
+      !in_pmem(cpu.pc) || (cpu.pc & 0x3) != 0 ||
+      !(entry_map[entry_word(cpu.pc) / 32] & (1u << (entry_word(cpu.pc) % 32)))) {
+    return 0;
+  }
+  aot_exit_request = false;
+  uint64_t nr = aot_exec(n);
+  nr_aot_inst += nr;
+  nr_aot_run ++;
+  return nr;
+}
+
+void aot_invalidate_code(paddr_t addr, int len) {
+  if (aot_invalidate != NULL) aot_invalidate(addr, len);
+}
+
+void aot_statistic() {
+  if (aot_exec == NULL) return;
+  extern uint64_t g_nr_guest_inst;
+  Log("AOT: %" PRIu64 " instructions (%.2f%%) in %" PRIu64 " runs of translated code",
+      nr_aot_inst, g_nr_guest_inst == 0 ? 0.0 : nr_aot_inst * 100.0 / g_nr_guest_inst, nr_aot_run);
+}
+#endif
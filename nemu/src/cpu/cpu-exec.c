@@ -16,7 +16,14 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/tb.h>
+#include <cpu/aot.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/cache.h>
 #include <locale.h>
+#include <setjmp.h>
 
 #include <isa.h>
 
@@ -46,22 +53,157 @@ CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
+// itrace and difftest are only done when enabled at runtime, see cpu_set_trace()
+static bool g_trace_enable = true;
+// the main loop runs until the number of guest instructions reaches the deadline
+static uint64_t g_deadline = 0;
+
+// Return the instruction count after executing `n' more instructions.
+static uint64_t count_after(uint64_t n)
+{
+  return n > UINT64_MAX - g_nr_guest_inst ? UINT64_MAX : g_nr_guest_inst + n;
+}
+
+// `g_deadline' is also cut by other threads and signal handlers through
+// cpu_notify_intr(), so it is only accessed atomically. The main loop only
+// modifies it with read-modify-write operations, which never lose a cut.
+#define deadline_load() __atomic_load_n(&g_deadline, __ATOMIC_RELAXED)
+
+static inline void deadline_min(uint64_t deadline)
+{
+  uint64_t old = deadline_load();
+  while (deadline < old &&
+      !__atomic_compare_exchange_n(&g_deadline, &old, deadline, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void cpu_post_deadline(uint64_t nr_inst)
+{
+  deadline_min(count_after(nr_inst));
+}
+
+// The release store pairs with the acquire exchange in the main loop, so
+// that device_update() sees what the caller did before, like setting a quit
+// request. If the deadline is reset after the store, the main loop still
+// handles it in that device_update().
+void cpu_notify_intr()
+{
+  __atomic_store_n(&g_deadline, 0, __ATOMIC_RELEASE);
+}
+
+// An exception raised in the middle of an instruction, e.g. a page fault,
+// leaves it with longjmp() to cpu_exec(). Only instructions executed one by
+// one raise them, since blocks are only built for untranslated fetches, and
+// the address space does not change inside a block. `exec_jmp_valid' is
+// false when no guest instruction is being executed.
+static jmp_buf exec_jmp;
+static bool exec_jmp_valid = false;
+static vaddr_t exception_pc;
+
+void cpu_raise_exception(word_t NO)
+{
+  if (!exec_jmp_valid)
+    return;
+  exception_pc = cpu.pc;
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+  longjmp(exec_jmp, 1);
+}
+
+#ifdef CONFIG_DEVICE
+// Deliver a pending interrupt if the guest accepts it. Interrupts are only
+// checked between runs of instructions, so nothing is paid per instruction.
+static void check_intr()
+{
+  if (likely(dev_intr_pending() == 0))
+    return;
+  word_t NO = isa_query_intr();
+  if (NO == INTR_EMPTY)
+    return;
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+  IFDEF(CONFIG_DIFFTEST, difftest_intr(NO));
+}
+#endif
 
 void device_update();
 
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc)
+void cpu_set_trace(bool enable)
 {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND)
+  if (enable == g_trace_enable)
+    return;
+  g_trace_enable = enable;
+  if (enable)
+    difftest_attach();
+  else
+    difftest_detach();
+  Log("Instruction trace and DiffTest: %s", enable ? ANSI_FMT("ON", ANSI_FG_GREEN) : ANSI_FMT("OFF", ANSI_FG_RED));
+}
+
+static bool wp_any_used()
+{
+  extern WP wp_pool[NR_WP];
+  for (int i = 0; i < NR_WP; i++)
+  {
+    if (wp_pool[i].used)
+      return true;
+  }
+  return false;
+}
+
+#ifdef CONFIG_ITRACE
+static void itrace_format(Decode *s)
+{
+  char *p = s->logbuf;
+  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
+  int ilen = s->snpc - s->pc;
+  int i;
+  uint8_t *inst = (uint8_t *)&s->isa.inst;
+#ifdef CONFIG_RVC
+  if (ilen == 2)
+    inst = (uint8_t *)&s->isa.cinst; // show the compressed encoding
+#endif
+#ifdef CONFIG_ISA_x86
+  for (i = 0; i < ilen; i++)
+  {
+#else
+  for (i = ilen - 1; i >= 0; i--)
   {
-    log_write("%s\n", _this->logbuf);
+#endif
+    p += snprintf(p, 4, " %02x", inst[i]);
   }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0)
+    space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
+              MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), inst, ilen);
+}
 #endif
-  if (g_print_step)
+
+// `_this' points to the `nr_inst' instructions executed since the last call,
+// `dnpc' is the pc after the last one of them
+static void trace_and_difftest(Decode *_this, int nr_inst, vaddr_t dnpc)
+{
+#ifdef CONFIG_ITRACE
+  for (int i = 0; i < nr_inst && (g_trace_enable || g_print_step); i++)
   {
-    IFDEF(CONFIG_ITRACE, puts(_this->logbuf));
+    itrace_format(&_this[i]);
+#ifdef CONFIG_ITRACE_COND
+    if (g_trace_enable && ITRACE_COND)
+    {
+      log_write("%s\n", _this[i].logbuf);
+    }
+#endif
+    if (g_print_step)
+    {
+      puts(_this[i].logbuf);
+    }
   }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+#endif
+  IFDEF(CONFIG_DIFFTEST, difftest_step(_this[nr_inst - 1].pc, dnpc, nr_inst));
 
   extern WP wp_pool[NR_WP];
 
@@ -73,7 +215,10 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc)
     if (wp_pool[i].used)
     {
       bool success = false;
+      // a page fault of the expression is not raised to the guest
+      exec_jmp_valid = false;
       int tmp = expr(wp_pool[i].expr, &success);
+      exec_jmp_valid = true;
       if (success)
       {
         if (tmp != wp_pool[i].old_val)
@@ -92,54 +237,132 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc)
   }
 }
 
+// the instruction at `pc' raised an exception instead of being executed
+static void trace_exception(vaddr_t pc)
+{
+#ifdef CONFIG_ITRACE
+  char buf[64];
+  snprintf(buf, sizeof(buf), FMT_WORD ": exception, continue at " FMT_WORD, pc, cpu.pc);
+#ifdef CONFIG_ITRACE_COND
+  if (g_trace_enable && ITRACE_COND)
+  {
+    log_write("%s\n", buf);
+  }
+#endif
+  if (g_print_step)
+  {
+    puts(buf);
+  }
+#endif
+  IFDEF(CONFIG_DIFFTEST, difftest_step(pc, cpu.pc, 1));
+}
+
 static void exec_once(Decode *s, vaddr_t pc)
 {
   s->pc = pc;
   s->snpc = pc;
   isa_exec_once(s);
   cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
-#ifdef CONFIG_ISA_x86
-  for (i = 0; i < ilen; i++)
-  {
-#else
-  for (i = ilen - 1; i >= 0; i--)
+}
+
+// The loops below are instantiated twice: execute_fast() never calls
+// trace_and_difftest(), and execute_trace() calls it after every step.
+#ifdef CONFIG_ENGINE_TB
+// Execute translation blocks until the deadline, and check the state at block exits.
+// Instructions not fetched from pmem are still executed one by one.
+static inline __attribute__((always_inline)) void execute_loop(uint64_t n, const bool trace)
+{
+  Decode s;
+  TB *tb = NULL;
+  uint64_t end = count_after(n);
+  while (nemu_state.state == NEMU_RUNNING && g_nr_guest_inst < end)
   {
+    deadline_min(end);
+#ifdef CONFIG_PMEM_SHARE
+    pmem_share_update();
+    cpu_post_deadline(CONFIG_PMEM_SHARE_INTERVAL);
 #endif
-    p += snprintf(p, 4, " %02x", inst[i]);
-  }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0)
-    space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
-
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-              MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
+    IFDEF(CONFIG_DEVICE, check_intr());
+    // the deadline may be cut by cpu_notify_intr() at any time, read it once
+    uint64_t deadline;
+    while (g_nr_guest_inst < (deadline = deadline_load()))
+    {
+#ifdef CONFIG_AOT
+      if (!trace)
+      {
+        uint64_t nr = aot_run(deadline - g_nr_guest_inst);
+        g_nr_guest_inst += nr;
+        if (nr > 0)
+          continue;
+      }
 #endif
+      uint64_t left = deadline - g_nr_guest_inst;
+      tb = tb_find(tb, cpu.pc);
+      int nr = 1;
+      if (tb != NULL)
+        nr = tb_exec(tb, left < tb->nr_inst ? left : tb->nr_inst);
+      else
+        exec_once(&s, cpu.pc);
+      g_nr_guest_inst += nr;
+      if (trace)
+      {
+        trace_and_difftest(tb != NULL ? tb->inst : &s, nr, cpu.pc);
+        if (nemu_state.state != NEMU_RUNNING)
+          break;
+      }
+    }
+    if (nemu_state.state != NEMU_RUNNING)
+      break;
+    __atomic_exchange_n(&g_deadline, UINT64_MAX, __ATOMIC_ACQUIRE);
+    IFDEF(CONFIG_DEVICE, device_update());
+  }
 }
-
-static void execute(uint64_t n)
+#else
+// Execute instructions until the deadline, and then handle the events.
+static inline __attribute__((always_inline)) void execute_loop(uint64_t n, const bool trace)
 {
   Decode s;
-  for (; n > 0; n--)
+  uint64_t end = count_after(n);
+  while (nemu_state.state == NEMU_RUNNING && g_nr_guest_inst < end)
   {
-    exec_once(&s, cpu.pc);
-    g_nr_guest_inst++;
-    trace_and_difftest(&s, cpu.pc);
+    deadline_min(end);
+#ifdef CONFIG_PMEM_SHARE
+    pmem_share_update();
+    cpu_post_deadline(CONFIG_PMEM_SHARE_INTERVAL);
+#endif
+    IFDEF(CONFIG_DEVICE, check_intr());
+    while (g_nr_guest_inst < deadline_load())
+    {
+#ifdef CONFIG_AOT
+      if (!trace)
+      {
+        // the deadline may be cut by cpu_notify_intr() at any time, read it once
+        uint64_t deadline = deadline_load();
+        uint64_t nr = deadline > g_nr_guest_inst ? aot_run(deadline - g_nr_guest_inst) : 0;
+        g_nr_guest_inst += nr;
+        if (nr > 0)
+          continue;
+      }
+#endif
+      exec_once(&s, cpu.pc);
+      g_nr_guest_inst++;
+      if (trace)
+      {
+        trace_and_difftest(&s, 1, cpu.pc);
+        if (nemu_state.state != NEMU_RUNNING)
+          break;
+      }
+    }
     if (nemu_state.state != NEMU_RUNNING)
       break;
+    __atomic_exchange_n(&g_deadline, UINT64_MAX, __ATOMIC_ACQUIRE);
     IFDEF(CONFIG_DEVICE, device_update());
   }
 }
+#endif
+
+static void execute_fast(uint64_t n) { execute_loop(n, false); }
+static void execute_trace(uint64_t n) { execute_loop(n, true); }
 
 static void statistic()
 {
@@ -151,6 +374,19 @@ static void statistic()
     Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else
     Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+#ifdef CONFIG_DECODE_CACHE
+  void decode_cache_statistic();
+  decode_cache_statistic();
+#endif
+  tlb_statistic();
+  IFDEF(CONFIG_CACHESIM, cache_statistic());
+  IFDEF(CONFIG_ENGINE_TB, tb_statistic());
+  IFDEF(CONFIG_AOT, aot_statistic());
+#ifdef CONFIG_FUSION
+  void fusion_statistic();
+  fusion_statistic();
+#endif
+  IFDEF(CONFIG_INSTPAT_BENCH, instpat_bench());
 }
 
 void assert_fail_msg()
@@ -163,6 +399,8 @@ void assert_fail_msg()
 void cpu_exec(uint64_t n)
 {
   g_print_step = (n < MAX_INST_TO_PRINT);
+  bool trace = g_print_step || wp_any_used() ||
+               (g_trace_enable && (MUXDEF(CONFIG_ITRACE, true, false) || MUXDEF(CONFIG_DIFFTEST, true, false)));
   switch (nemu_state.state)
   {
   case NEMU_END:
@@ -176,10 +414,30 @@ void cpu_exec(uint64_t n)
 
   uint64_t timer_start = get_time();
 
-  execute(n);
+  // come back here after an exception, see cpu_raise_exception()
+  uint64_t start = g_nr_guest_inst;
+  if (setjmp(exec_jmp) != 0)
+  {
+    exec_jmp_valid = false;
+    // the instruction is counted, since it is a step of the REF in DiffTest
+    g_nr_guest_inst++;
+    if (trace)
+      trace_exception(exception_pc);
+  }
+  uint64_t done = g_nr_guest_inst - start;
+  if (nemu_state.state == NEMU_RUNNING && done < n)
+  {
+    exec_jmp_valid = true;
+    if (trace)
+      execute_trace(n - done);
+    else
+      execute_fast(n - done);
+    exec_jmp_valid = false;
+  }
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
+  IFDEF(CONFIG_PMEM_SHARE, pmem_share_update());
 
   switch (nemu_state.state)
   {
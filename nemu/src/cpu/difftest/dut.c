@@ -17,6 +17,7 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/tb.h>
 #include <memory/paddr.h>
 #include <utils.h>
 #include <difftest-def.h>
@@ -30,6 +31,7 @@ void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+static bool is_detach = false;
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
@@ -43,6 +45,8 @@ void difftest_skip_ref() {
   // will load that memory, we will encounter false negative. But such
   // situation is infrequent.
   skip_dut_nr_inst = 0;
+  // end the current block, so that the skipped instruction is the last one checked
+  IFDEF(CONFIG_ENGINE_TB, tb_exit_request = true);
 }
 
 // this is used to deal with instruction packing in QEMU.
@@ -91,6 +95,33 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
 }
 
+// stop comparing with REF, which is left behind
+void difftest_detach() {
+  is_detach = true;
+}
+
+// bring REF to the state of DUT and compare again
+void difftest_attach() {
+  is_detach = false;
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), PMEM_RIGHT - RESET_VECTOR + 1, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+}
+
+// the interrupt `NO' is taken by DUT between two instructions, let REF take it too
+void difftest_intr(word_t NO) {
+  if (is_detach) return;
+  ref_difftest_raise_intr(NO);
+}
+
+// [addr, addr + n) of pmem is changed by DUT without REF executing the
+// instruction, e.g. by a hostcall, copy it to REF
+void difftest_sync_mem(paddr_t addr, size_t n) {
+  if (is_detach) return;
+  ref_difftest_memcpy(addr, guest_to_host(addr), n, DIFFTEST_TO_REF);
+}
+
 static void checkregs(CPU_state *ref, vaddr_t pc) {
   if (!isa_difftest_checkregs(ref, pc)) {
     nemu_state.state = NEMU_ABORT;
@@ -99,9 +130,12 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
   }
 }
 
-void difftest_step(vaddr_t pc, vaddr_t npc) {
+// `nr_inst' instructions starting from `pc' are executed by DUT
+void difftest_step(vaddr_t pc, vaddr_t npc, int nr_inst) {
   CPU_state ref_r;
 
+  if (is_detach) return;
+
   if (skip_dut_nr_inst > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
@@ -117,12 +151,13 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
 
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
+    if (nr_inst > 1) ref_difftest_exec(nr_inst - 1);
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
     is_skip_ref = false;
     return;
   }
 
-  ref_difftest_exec(1);
+  ref_difftest_exec(nr_inst);
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
@@ -17,21 +17,36 @@
 #include <cpu/cpu.h>
 #include <difftest-def.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    memcpy(guest_to_host(addr), buf, n);
+    pmem_check_code_write(addr, n);
+  }
+  else memcpy(buf, guest_to_host(addr), n);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    IFDEF(CONFIG_DECODE_CACHE, int mmu_mode = isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH));
+    memcpy(&cpu, dut, sizeof(cpu));
+    // the address space may be changed by DUT
+    tlb_flush();
+#ifdef CONFIG_DECODE_CACHE
+    void init_decode_cache();
+    if (isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) != mmu_mode) init_decode_cache();
+#endif
+  }
+  else memcpy(dut, &cpu, sizeof(cpu));
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec(n);
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
@@ -0,0 +1,151 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+#define MAX_INDEX_BIT 12
+#define MIN_TABLE_PAT 8
+
+static InstPatTable *tables = NULL;
+
+void instpat_add(InstPatTable *t, const char *pattern, int len, const void *label) {
+  uint64_t key, mask, shift;
+  pattern_decode(pattern, len, &key, &mask, &shift);
+  int width = 0;
+  for (int i = 0; i < len; i ++) width += (pattern[i] != ' ');
+  if (width > t->width) t->width = width;
+
+  if (t->nr_pat == t->max_pat) {
+    t->max_pat = (t->max_pat == 0 ? 64 : t->max_pat * 2);
+    t->pat = realloc(t->pat, sizeof(t->pat[0]) * t->max_pat);
+    assert(t->pat);
+  }
+  t->pat[t->nr_pat ++] = (InstPat) { .key = key << shift, .mask = mask << shift, .label = label };
+}
+
+static bool pat_fits(InstPat *p, int nr_bit, const int *bit, uint32_t idx) {
+  for (int j = 0; j < nr_bit; j ++) {
+    uint64_t b = 1ull << bit[j];
+    if ((p->mask & b) && !!(p->key & b) != ((idx >> j) & 1)) return false;
+  }
+  return true;
+}
+
+void instpat_build(InstPatTable *t, const void *nomatch) {
+  // a bit distinguishes the patterns better if more patterns fix it,
+  // but it is useless if all of them fix it to the same value
+  int score[64], bit[MAX_INDEX_BIT], nr_bit = 0;
+  for (int b = 0; b < 64; b ++) {
+    int n0 = 0, n1 = 0;
+    for (int i = 0; i < t->nr_pat; i ++) {
+      if (t->pat[i].mask & (1ull << b)) { if (t->pat[i].key & (1ull << b)) n1 ++; else n0 ++; }
+    }
+    score[b] = (n0 > 0 && n1 > 0 ? n0 + n1 : 0);
+  }
+  // a few patterns are faster to be checked one by one
+  int max_bit = (t->nr_pat < MIN_TABLE_PAT ? 0 : MAX_INDEX_BIT);
+  while (nr_bit < max_bit) {
+    int best = 0;
+    for (int b = 1; b < 64; b ++) if (score[b] > score[best]) best = b;
+    if (score[best] == 0) break;
+    score[best] = 0;
+    bit[nr_bit ++] = best;
+  }
+  // sort the index bits, so that adjacent bits are gathered together
+  for (int i = 1; i < nr_bit; i ++) {
+    for (int j = i; j > 0 && bit[j - 1] > bit[j]; j --) { int tmp = bit[j]; bit[j] = bit[j - 1]; bit[j - 1] = tmp; }
+  }
+  t->nr_field = 0;
+  for (int j = 0; j < nr_bit; j ++) {
+    if (t->nr_field > 0) {
+      typeof(t->field[0]) *f = &t->field[t->nr_field - 1];
+      if (f->lsb + f->len == bit[j]) { f->len ++; continue; }
+    }
+    Assert(t->nr_field < INSTPAT_MAX_FIELD, "too many index fields in %s", t->loc);
+    t->field[t->nr_field ++] = (typeof(t->field[0])) { .lsb = bit[j], .len = 1, .pos = j };
+  }
+
+  int nr_bucket = 1 << nr_bit, nr_cand = 0, max_cand = nr_bucket * 4;
+  t->bucket = malloc(sizeof(t->bucket[0]) * nr_bucket);
+  t->cand = malloc(sizeof(t->cand[0]) * max_cand);
+  assert(t->bucket && t->cand);
+  for (uint32_t idx = 0; idx < nr_bucket; idx ++) {
+    t->bucket[idx] = nr_cand;
+    for (int i = 0; i <= t->nr_pat; i ++) {
+      if (nr_cand == max_cand) {
+        max_cand *= 2;
+        t->cand = realloc(t->cand, sizeof(t->cand[0]) * max_cand);
+        assert(t->cand);
+      }
+      if (i == t->nr_pat) t->cand[nr_cand ++] = -1;
+      else if (pat_fits(&t->pat[i], nr_bit, bit, idx)) {
+        t->cand[nr_cand ++] = i;
+        // the following patterns are never checked
+        if (t->pat[i].mask == 0) { t->cand[nr_cand ++] = -1; break; }
+      }
+    }
+  }
+
+  t->nr_index_bit = nr_bit;
+  t->nomatch = nomatch;
+  t->ready = true;
+  t->next = tables;
+  tables = t;
+}
+
+#ifdef CONFIG_INSTPAT_BENCH
+#define NR_BENCH_INST 4096
+#define NR_BENCH_ROUND 1000
+
+static volatile uintptr_t bench_sink;
+
+static const void* lookup_linear(InstPatTable *t, uint64_t inst) {
+  for (int i = 0; i < t->nr_pat; i ++) {
+    if ((inst & t->pat[i].mask) == t->pat[i].key) return t->pat[i].label;
+  }
+  return t->nomatch;
+}
+
+void instpat_bench() {
+  static uint64_t inst[NR_BENCH_INST];
+  for (InstPatTable *t = tables; t != NULL; t = t->next) {
+    // generate instructions from each pattern, with random don't-care bits
+    uint64_t width_mask = (t->width >= 64 ? -1ull : (1ull << t->width) - 1);
+    for (int i = 0; i < NR_BENCH_INST; i ++) {
+      InstPat *p = &t->pat[i % t->nr_pat];
+      uint64_t r = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+      inst[i] = ((r & ~p->mask) | p->key) & width_mask;
+      Assert(lookup_linear(t, inst[i]) == instpat_lookup(t, inst[i]),
+          "decode table of %s mismatches at inst = 0x%" PRIx64, t->loc, inst[i]);
+    }
+
+    uintptr_t sink = 0;
+    uint64_t start = get_time();
+    for (int k = 0; k < NR_BENCH_ROUND; k ++)
+      for (int i = 0; i < NR_BENCH_INST; i ++) sink ^= (uintptr_t)lookup_linear(t, inst[i]);
+    uint64_t linear = get_time() - start;
+    start = get_time();
+    for (int k = 0; k < NR_BENCH_ROUND; k ++)
+      for (int i = 0; i < NR_BENCH_INST; i ++) sink ^= (uintptr_t)instpat_lookup(t, inst[i]);
+    uint64_t table = get_time() - start;
+
+    bench_sink = sink; // keep the lookups from being optimized away
+
+    double nr = (double)NR_BENCH_INST * NR_BENCH_ROUND;
+    Log("decode table at %s: %d patterns, %d index bits, linear = %.2f ns, table = %.2f ns per lookup",
+        t->loc, t->nr_pat, t->nr_index_bit, linear * 1000.0 / nr, table * 1000.0 / nr);
+  }
+}
+#endif
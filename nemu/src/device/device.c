@@ -15,7 +15,8 @@
 
 #include <common.h>
 #include <utils.h>
-#include <device/alarm.h>
+#include <device/event.h>
+#include <cpu/cpu.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -28,49 +29,74 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
-void init_alarm();
 
 void send_key(uint8_t, bool);
-void vga_update_screen();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
+#if defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_TARGET_AM)
+#include <stdatomic.h>
 
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+void vga_init_screen();
+void vga_present();
 
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
+// Many platforms, e.g. macOS, only allow the main thread to use the video
+// subsystem and to receive events, so SDL is driven by the main thread,
+// which owns the window, translates host events and presents frames, while
+// the engine runs in a thread of its own. They talk only through the
+// lock-free key queue of i8042, the frame buffers of VGA and `quit_request',
+// so the CPU never waits for the host.
+#define SDL_POLL_MS 4
+static atomic_bool quit_request = false;
+static atomic_bool engine_done = false;
+
+static int engine_thread(void *engine) {
+  ((void (*)())engine)();
+  atomic_store_explicit(&engine_done, true, memory_order_release);
+  return 0;
+}
+
+void sdl_mainloop(void (*engine)()) {
+  vga_init_screen();
+  SDL_Thread *t = SDL_CreateThread(engine_thread, "nemu-engine", engine);
+  Assert(t, "Can not create the engine thread: %s", SDL_GetError());
+  while (!atomic_load_explicit(&engine_done, memory_order_acquire)) {
+    SDL_Event event;
+    // wake up at least every SDL_POLL_MS to present the frames synced
+    if (!SDL_WaitEventTimeout(&event, SDL_POLL_MS)) { vga_present(); continue; }
+    do {
+      switch (event.type) {
+        case SDL_QUIT:
+          atomic_store_explicit(&quit_request, true, memory_order_relaxed);
+          cpu_notify_intr();
+          break;
 #ifdef CONFIG_HAS_KEYBOARD
-      // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
+        // If a key was pressed
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: {
+          uint8_t k = event.key.keysym.scancode;
+          bool is_keydown = (event.key.type == SDL_KEYDOWN);
+          send_key(k, is_keydown);
+          break;
+        }
 #endif
-      default: break;
-    }
+        default: break;
+      }
+    } while (SDL_PollEvent(&event));
+    vga_present();
   }
-#endif
+  SDL_WaitThread(t, NULL);
 }
+#endif
 
-void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event));
+// The CPU calls device_update() at the deadline of the earliest event,
+// or when another thread cuts the deadline.
+void device_update() {
+#if defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_TARGET_AM)
+  if (atomic_load_explicit(&quit_request, memory_order_relaxed)) {
+    nemu_state.state = NEMU_QUIT;
+    return;
+  }
 #endif
+  event_run();
 }
 
 void init_device() {
@@ -84,6 +110,4 @@ void init_device() {
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
-
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
 }
@@ -0,0 +1,167 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <utils.h>
+#include <device/event.h>
+#include <cpu/cpu.h>
+
+typedef struct {
+  const char *name;
+  uint64_t when;    // virtual time of the next call
+  uint64_t period;  // 0 for one-shot events
+  event_handler_t handler;
+  int heap_idx;     // -1 if not scheduled
+} Event;
+
+static Event *events = NULL;
+static int nr_event = 0;
+// scheduled events in a binary min-heap ordered by `when'
+static int *heap = NULL;
+static int nr_heap = 0;
+
+static inline bool earlier(int a, int b) { return events[a].when < events[b].when; }
+
+static inline void heap_set(int i, int id) {
+  heap[i] = id;
+  events[id].heap_idx = i;
+}
+
+static void sift_up(int i) {
+  int id = heap[i];
+  while (i > 0 && earlier(id, heap[(i - 1) / 2])) {
+    heap_set(i, heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  heap_set(i, id);
+}
+
+static void sift_down(int i) {
+  int id = heap[i];
+  while (2 * i + 1 < nr_heap) {
+    int c = 2 * i + 1;
+    if (c + 1 < nr_heap && earlier(heap[c + 1], heap[c])) c ++;
+    if (!earlier(heap[c], id)) break;
+    heap_set(i, heap[c]);
+    i = c;
+  }
+  heap_set(i, id);
+}
+
+static void heap_remove(int id) {
+  int i = events[id].heap_idx;
+  events[id].heap_idx = -1;
+  nr_heap --;
+  if (i == nr_heap) return;
+  int last = heap[nr_heap];
+  heap_set(i, last);
+  sift_up(i);
+  sift_down(events[last].heap_idx);
+}
+
+static void heap_insert(int id) {
+  heap_set(nr_heap ++, id);
+  sift_up(nr_heap - 1);
+}
+
+extern uint64_t g_nr_guest_inst;
+
+// The deadline of the CPU is counted in guest instructions. With icount,
+// the instruction count of the next event is exact. Otherwise the time
+// until it is converted with the rate measured in event_run(). If the
+// rate is underestimated, the CPU returns before the event is due, and
+// the deadline is posted again. If it is overestimated, the deadline is
+// too far and the event runs late. To bound this, the CPU returns at least
+// every DEADLINE_SLICE_US at the measured rate, so an event is late by at
+// most one slice times the error of the rate, which is measured again then.
+#define DEADLINE_MAX (1ull << 24)
+#define DEADLINE_SLICE_US 1000
+IFNDEF(CONFIG_TIME_ICOUNT, static double inst_per_us = 1);
+
+static void post_deadline(uint64_t now) {
+  if (nr_heap == 0) { cpu_post_deadline(DEADLINE_MAX); return; }
+  uint64_t when = events[heap[0]].when;
+#ifdef CONFIG_TIME_ICOUNT
+  uint64_t due = when * CONFIG_ICOUNT_INST_PER_US;
+  uint64_t n = due <= g_nr_guest_inst ? 0 : due - g_nr_guest_inst;
+#else
+  uint64_t until = when <= now ? 0 : when - now;
+  double n = (until < DEADLINE_SLICE_US ? until : DEADLINE_SLICE_US) * inst_per_us;
+#endif
+  cpu_post_deadline(n < DEADLINE_MAX ? (uint64_t)n : DEADLINE_MAX);
+}
+
+uint64_t event_now() {
+  return MUXDEF(CONFIG_TIME_ICOUNT, g_nr_guest_inst / CONFIG_ICOUNT_INST_PER_US, get_time());
+}
+
+int event_add(const char *name, uint64_t period, event_handler_t handler) {
+  events = realloc(events, sizeof(Event) * (nr_event + 1));
+  heap = realloc(heap, sizeof(int) * (nr_event + 1));
+  assert(events && heap);
+  int id = nr_event ++;
+  events[id] = (Event) { .name = name, .period = period, .handler = handler, .heap_idx = -1 };
+  if (period != 0) event_schedule(id, period);
+  return id;
+}
+
+void event_schedule(int id, uint64_t delay) {
+  assert(id >= 0 && id < nr_event);
+  uint64_t now = event_now();
+  events[id].when = now + delay;
+  if (events[id].heap_idx == -1) heap_insert(id);
+  else {
+    sift_up(events[id].heap_idx);
+    sift_down(events[id].heap_idx);
+  }
+  if (heap[0] == id) post_deadline(now);
+}
+
+void event_cancel(int id) {
+  assert(id >= 0 && id < nr_event);
+  if (events[id].heap_idx != -1) heap_remove(id);
+}
+
+void event_run() {
+  uint64_t now = event_now();
+#ifndef CONFIG_TIME_ICOUNT
+  static uint64_t last_time = 0, last_inst = 0;
+  // measure with samples of at least 1 ms, and smooth them when the rate
+  // goes up, but follow a slowdown at once, since it makes events late
+  if (now - last_time >= 1000) {
+    double rate = (double)(g_nr_guest_inst - last_inst) / (now - last_time);
+    inst_per_us = rate < inst_per_us ? rate : (inst_per_us + rate) / 2;
+    // a sample across a stop of the CPU, e.g. in sdb, should not stall it
+    if (inst_per_us < 1) inst_per_us = 1;
+    last_time = now;
+    last_inst = g_nr_guest_inst;
+  }
+#endif
+
+  while (nr_heap > 0 && events[heap[0]].when <= now) {
+    int id = heap[0];
+    Event *e = &events[id];
+    if (e->period != 0) {
+      // periods missed, e.g. when the CPU is stopped, are skipped
+      e->when += e->period;
+      if (e->when <= now) e->when = now + e->period;
+      sift_down(0);
+    } else {
+      heap_remove(id);
+    }
+    e->handler();
+  }
+  post_deadline(now);
+}
@@ -13,7 +13,26 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <isa.h>
+#include <device/intr.h>
+#include <cpu/cpu.h>
+#include <stdatomic.h>
 
-void dev_raise_intr() {
+// One bit for each request line. Devices may raise interrupts in signal
+// handlers, so the mask is only accessed with lock-free atomic operations.
+static atomic_uint intr_pending = 0;
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the pending mask should be lock-free");
+
+void dev_raise_intr(int irq) {
+  assert(irq >= 0 && irq < NR_IRQ);
+  atomic_fetch_or_explicit(&intr_pending, 1u << irq, memory_order_relaxed);
+  cpu_notify_intr();
+}
+
+// called by the ISA when the interrupt is taken
+void dev_ack_intr(int irq) {
+  atomic_fetch_and_explicit(&intr_pending, ~(1u << irq), memory_order_relaxed);
+}
+
+uint32_t dev_intr_pending() {
+  return atomic_load_explicit(&intr_pending, memory_order_relaxed);
 }
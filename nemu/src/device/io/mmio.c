@@ -15,15 +15,54 @@
 
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
-#define NR_MAP 16
+// Maps are kept sorted by address, so that any address can be looked up by
+// binary search. On top of that, a two-level page table over the low 4 GiB
+// gives the map of a page directly if the map covers the whole page. Pages
+// shared by several small maps, e.g. the registers of different devices,
+// are marked with MAP_SHARED and fall back to the search.
+#define PT_BITS 10
+#define NR_PT (1u << PT_BITS)
+#define MAP_SHARED ((IOMap *)1)
 
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+static IOMap **maps = NULL;
+static int nr_map = 0, max_map = 0;
+static IOMap **page_map[NR_PT] = {};
+
+static IOMap* search_mmio_map(paddr_t addr) {
+  // find the last map starting at or below `addr'
+  int l = 0, r = nr_map - 1, idx = -1;
+  while (l <= r) {
+    int m = (l + r) / 2;
+    if (maps[m]->low <= addr) { idx = m; l = m + 1; }
+    else r = m - 1;
+  }
+  return (idx != -1 && map_inside(maps[idx], addr) ? maps[idx] : NULL);
+}
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  if (likely((uint64_t)addr >> 32 == 0)) {
+    IOMap **pt = page_map[addr >> (PAGE_SHIFT + PT_BITS)];
+    if (pt == NULL) return NULL;
+    IOMap *map = pt[(addr >> PAGE_SHIFT) & (NR_PT - 1)];
+    if (likely(map != MAP_SHARED)) return map;
+  }
+  return search_mmio_map(addr);
+}
+
+static void page_map_add(IOMap *map) {
+  uint64_t low = map->low, high = map->high;
+  for (uint64_t page = low & ~(uint64_t)PAGE_MASK; page <= high && page >> 32 == 0; page += PAGE_SIZE) {
+    IOMap ***pt = &page_map[page >> (PAGE_SHIFT + PT_BITS)];
+    if (*pt == NULL) {
+      *pt = calloc(NR_PT, sizeof(**pt));
+      assert(*pt);
+    }
+    IOMap **e = &(*pt)[(page >> PAGE_SHIFT) & (NR_PT - 1)];
+    bool whole = (low <= page && high >= page + PAGE_MASK);
+    *e = (*e == NULL && whole ? map : MAP_SHARED);
+  }
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -34,23 +73,44 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
 
 /* device interface */
 void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
   paddr_t left = addr, right = addr + len - 1;
   if (in_pmem(left) || in_pmem(right)) {
     report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
   }
-  for (int i = 0; i < nr_map; i++) {
-    if (left <= maps[i].high && right >= maps[i].low) {
-      report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
-    }
+#ifdef CONFIG_MEM_REGIONS_ENABLE
+  MemRegion *r = mem_region(left);
+  if (r == NULL) r = mem_region(right);
+  if (r != NULL) report_mmio_overlap(name, left, right, r->name, r->base, r->base + r->size - 1);
+#endif
+
+  // the first map after the new one
+  int pos = 0;
+  while (pos < nr_map && maps[pos]->low <= left) pos ++;
+  if (pos > 0 && maps[pos - 1]->high >= left) {
+    report_mmio_overlap(name, left, right, maps[pos - 1]->name, maps[pos - 1]->low, maps[pos - 1]->high);
+  }
+  if (pos < nr_map && maps[pos]->low <= right) {
+    report_mmio_overlap(name, left, right, maps[pos]->name, maps[pos]->low, maps[pos]->high);
   }
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
+  if (nr_map == max_map) {
+    max_map = (max_map == 0 ? 16 : max_map * 2);
+    maps = realloc(maps, sizeof(*maps) * max_map);
+    assert(maps);
+  }
+  IOMap *map = malloc(sizeof(*map));
+  assert(map);
+  *map = (IOMap){ .name = name, .low = left, .high = right,
     .space = space, .callback = callback };
-  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
-
+  memmove(&maps[pos + 1], &maps[pos], sizeof(*maps) * (nr_map - pos));
+  maps[pos] = map;
   nr_map ++;
+  page_map_add(map);
+  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]", map->name, map->low, map->high);
+
+  // regions without callbacks are plain memory, let the CPU access them directly,
+  // except for DiffTest, which should skip checking every access to devices
+  if (callback == NULL) IFNDEF(CONFIG_DIFFTEST, paddr_map_host(left, len, space, true));
 }
 
 /* bus interface */
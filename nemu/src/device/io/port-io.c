@@ -17,33 +17,38 @@
 
 #define PORT_IO_SPACE_MAX 65535
 
-#define NR_MAP 16
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+// the map of each port
+static IOMap *port_map[PORT_IO_SPACE_MAX + 1] = {};
 
 /* device interface */
 void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
   assert(addr + len <= PORT_IO_SPACE_MAX);
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
+  IOMap *map = malloc(sizeof(*map));
+  assert(map);
+  *map = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
-  Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
-
-  nr_map ++;
+  for (uint32_t i = addr; i < addr + len; i ++) {
+    IOMap *old = port_map[i];
+    if (old != NULL) {
+      panic("port-io region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped "
+          "with %s@[" FMT_PADDR ", " FMT_PADDR "]", name, map->low, map->high, old->name, old->low, old->high);
+    }
+    port_map[i] = map;
+  }
+  Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]", map->name, map->low, map->high);
 }
 
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  return map_read(addr, len, &maps[mapid]);
+  IOMap *map = port_map[addr];
+  assert(map != NULL);
+  return map_read(addr, len, map);
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  map_write(addr, len, data, &maps[mapid]);
+  IOMap *map = port_map[addr];
+  assert(map != NULL);
+  map_write(addr, len, data, map);
 }
@@ -14,12 +14,14 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
 
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 // Note that this is not the standard
 #define NEMU_KEYS(f) \
@@ -45,29 +47,38 @@ static void init_keymap() {
   MAP(NEMU_KEYS, SDL_KEYMAP)
 }
 
+// A single-producer single-consumer ring. Keys are enqueued by the SDL
+// thread, and dequeued by the CPU thread when the guest reads the port.
 #define KEY_QUEUE_LEN 1024
-static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+static uint32_t key_queue[KEY_QUEUE_LEN] = {};
+static atomic_uint key_f = 0, key_r = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  unsigned r = atomic_load_explicit(&key_r, memory_order_relaxed);
+  unsigned next = (r + 1) % KEY_QUEUE_LEN;
+  if (next == atomic_load_explicit(&key_f, memory_order_acquire)) {
+    Log("key queue overflow, key %#x dropped", am_scancode);
+    return;
+  }
+  key_queue[r] = am_scancode;
+  atomic_store_explicit(&key_r, next, memory_order_release);
 }
 
 static uint32_t key_dequeue() {
-  uint32_t key = NEMU_KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
-  }
+  unsigned f = atomic_load_explicit(&key_f, memory_order_relaxed);
+  if (f == atomic_load_explicit(&key_r, memory_order_acquire)) return NEMU_KEY_NONE;
+  uint32_t key = key_queue[f];
+  atomic_store_explicit(&key_f, (f + 1) % KEY_QUEUE_LEN, memory_order_release);
   return key;
 }
 
 void send_key(uint8_t scancode, bool is_keydown) {
-  if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
+  // keys pressed while the guest is stopped are dropped
+  if (__atomic_load_n(&nemu_state.state, __ATOMIC_RELAXED) == NEMU_RUNNING &&
+      keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_enqueue(am_scancode);
+    dev_raise_intr(IRQ_KEYBOARD);
   }
 }
 #else // !CONFIG_TARGET_AM
@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/event.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -36,12 +37,64 @@ static uint32_t *vgactl_port_base = NULL;
 
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
+#define ROW_BYTES (SCREEN_W * sizeof(uint32_t))
+#define NR_VMEM_PAGE ((SCREEN_H * ROW_BYTES + PAGE_SIZE - 1) / PAGE_SIZE)
+#define NR_ROW_WORD ((SCREEN_H + 63) / 64)
+
+// Stores into vmem are tracked by pages. vmem is mapped read-only for the
+// CPU, so the first store into a page after a sync goes through
+// vmem_io_handler(), which marks the page dirty and lets the following
+// stores access it directly. A sync maps vmem read-only again, and passes
+// the rows covered by dirty pages to the SDL thread.
+static bool page_dirty[NR_VMEM_PAGE] = {};
+
+// The screen is owned by the SDL thread, i.e. the main thread in device.c,
+// which uploads frames to the texture and presents them, so the CPU never
+// waits for the upload or vsync. Frames are passed through three buffers: at a sync the CPU
+// copies the dirty rows of vmem into its back buffer and publishes it as the
+// ready one, and the SDL thread swaps its front buffer with the ready one.
+// The upload thus never reads vmem while the guest is drawing into it. A
+// frame replaced before the SDL thread takes it is dropped, and its rows are
+// uploaded with the next one.
+#define FB_FRESH 4
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
+static uint32_t fb[3][SCREEN_H * SCREEN_W];
+// rows to upload from each buffer, written by the CPU before publishing it
+static uint64_t fb_rows[3][NR_ROW_WORD];
+// rows of each buffer older than vmem, only accessed by the CPU
+static uint64_t fb_stale[3][NR_ROW_WORD];
+static int fb_back = 1, fb_front = 0;
+// the ready buffer, with FB_FRESH until the SDL thread takes it
+static atomic_int fb_ready = 2 | FB_FRESH;
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  for (uint32_t p = offset / PAGE_SIZE; p <= (offset + len - 1) / PAGE_SIZE; p ++) {
+    if (page_dirty[p]) continue;
+    page_dirty[p] = true;
+    // the last page is not mapped, since it is shared with other devices
+    if ((p + 1) * PAGE_SIZE <= SCREEN_H * ROW_BYTES) {
+      IFNDEF(CONFIG_DIFFTEST, paddr_map_host(CONFIG_FB_ADDR + p * PAGE_SIZE, PAGE_SIZE,
+            (uint8_t *)vmem + p * PAGE_SIZE, true));
+    }
+  }
+}
 
 static void init_screen() {
+  static_assert(CONFIG_FB_ADDR % PAGE_SIZE == 0, "the frame buffer should be page aligned");
+  IFNDEF(CONFIG_DIFFTEST, paddr_map_host(CONFIG_FB_ADDR, SCREEN_H * ROW_BYTES, vmem, false));
+  // the texture is uploaded entirely for the first frame
+  for (int i = 0; i < NR_ROW_WORD; i ++) fb_rows[2][i] = UINT64_MAX;
+}
+
+// called in the SDL thread
+void vga_init_screen() {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
@@ -50,18 +103,76 @@ static void init_screen() {
       SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
       SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
       0, &window, &renderer);
+  Assert(window && renderer, "Can not create the SDL window: %s", SDL_GetError());
   SDL_SetWindowTitle(window, title);
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+// called in the SDL thread
+void vga_present() {
+  if (!(atomic_load_explicit(&fb_ready, memory_order_relaxed) & FB_FRESH)) return;
+  // the CPU can only replace it with a newer frame in the meantime
+  fb_front = atomic_exchange_explicit(&fb_ready, fb_front, memory_order_acq_rel) & ~FB_FRESH;
+  uint64_t *rows = fb_rows[fb_front];
+#define ROW_IS_DIRTY(y) ((rows[(y) / 64] >> ((y) % 64)) & 1)
+  // upload each run of dirty rows with one rectangle
+  for (int y = 0; y < SCREEN_H; ) {
+    if (!ROW_IS_DIRTY(y)) { y ++; continue; }
+    int y0 = y;
+    while (y < SCREEN_H && ROW_IS_DIRTY(y)) y ++;
+    SDL_Rect rect = { .x = 0, .y = y0, .w = SCREEN_W, .h = y - y0 };
+    SDL_UpdateTexture(texture, &rect, &fb[fb_front][y0 * SCREEN_W], ROW_BYTES);
+  }
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+static inline void update_screen() {
+  uint64_t rows[NR_ROW_WORD] = {};
+  bool dirty = false;
+  for (int p = 0; p < NR_VMEM_PAGE; p ++) {
+    if (!page_dirty[p]) continue;
+    page_dirty[p] = false;
+    dirty = true;
+    int last = ((p + 1) * PAGE_SIZE - 1) / ROW_BYTES;
+    for (int y = p * PAGE_SIZE / ROW_BYTES; y <= last && y < SCREEN_H; y ++) {
+      rows[y / 64] |= 1ull << (y % 64);
+    }
+  }
+  // frames without stores into vmem are not presented
+  if (!dirty) return;
+  IFNDEF(CONFIG_DIFFTEST, paddr_map_host(CONFIG_FB_ADDR, SCREEN_H * ROW_BYTES, vmem, false));
+  // translations caching the writable pages
+  tlb_flush();
+
+  for (int b = 0; b < 3; b ++) {
+    for (int i = 0; i < NR_ROW_WORD; i ++) fb_stale[b][i] |= rows[i];
+  }
+  uint64_t *stale = fb_stale[fb_back];
+  for (int y = 0; y < SCREEN_H; y ++) {
+    if ((stale[y / 64] >> (y % 64)) & 1) {
+      memcpy(&fb[fb_back][y * SCREEN_W], (uint8_t *)vmem + y * ROW_BYTES, ROW_BYTES);
+    }
+  }
+  memset(stale, 0, sizeof(fb_stale[0]));
+
+  // Publish the back buffer. If the ready frame is not taken yet, it is
+  // dropped, so its rows are uploaded with this one. The CAS fails only if
+  // the SDL thread takes it in the meantime.
+  int ready = atomic_load_explicit(&fb_ready, memory_order_relaxed);
+  do {
+    for (int i = 0; i < NR_ROW_WORD; i ++) {
+      fb_rows[fb_back][i] = rows[i] | ((ready & FB_FRESH) ? fb_rows[ready & ~FB_FRESH][i] : 0);
+    }
+  } while (!atomic_compare_exchange_weak_explicit(&fb_ready, &ready, fb_back | FB_FRESH,
+        memory_order_acq_rel, memory_order_relaxed));
+  fb_back = ready & ~FB_FRESH;
+}
+
+#define VMEM_HANDLER vmem_io_handler
 #else
 static void init_screen() {}
 
@@ -71,9 +182,98 @@ static inline void update_screen() {
 #endif
 #endif
 
-void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+#ifdef CONFIG_VGA_CAPTURE
+// The frames synced are written to a video stream instead of a window.
+// A frame identical to the previous one written is dropped, so a program
+// waiting for input does not blow up the stream.
+static FILE *capture_fp = NULL;
+static bool capture_is_pipe = false;
+static uint64_t last_hash = 0;
+static uint64_t nr_sync = 0, nr_capture = 0, nr_dup = 0;
+
+static uint64_t frame_hash() {
+  // FNV-1a on 64-bit words
+  uint64_t h = 0xcbf29ce484222325ull;
+  uint64_t *p = vmem;
+  for (int i = 0; i < SCREEN_W * SCREEN_H / 2; i ++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static void capture_close() {
+  if (capture_fp == NULL) return;
+  Log("VGA capture: %" PRIu64 " frames written, %" PRIu64 " duplicated frames dropped, %" PRIu64 " syncs",
+      nr_capture, nr_dup, nr_sync);
+  if (capture_is_pipe) pclose(capture_fp);
+  else fclose(capture_fp);
+  capture_fp = NULL;
+}
+
+static void init_screen() {
+  const char *file = CONFIG_VGA_CAPTURE_FILE;
+  capture_is_pipe = (file[0] == '|');
+  capture_fp = capture_is_pipe ? popen(file + 1, "w") : fopen(file, "w");
+  Assert(capture_fp, "Can not open %s for the VGA capture", file);
+  Log("VGA capture: writing frames to %s", file);
+#ifdef CONFIG_VGA_CAPTURE_Y4M
+  fprintf(capture_fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+      SCREEN_W, SCREEN_H, TIMER_HZ, CONFIG_VGA_CAPTURE_INTERVAL);
+#endif
+  atexit(capture_close);
+}
+
+static void write_frame() {
+  static uint8_t buf[SCREEN_W * SCREEN_H * 3];
+  uint32_t *fb = vmem;
+#ifdef CONFIG_VGA_CAPTURE_Y4M
+  // BT.601 studio range, planar Y, Cb, Cr
+  uint8_t *y = buf, *u = buf + SCREEN_W * SCREEN_H, *v = u + SCREEN_W * SCREEN_H;
+  for (int i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    int r = (fb[i] >> 16) & 0xff, g = (fb[i] >> 8) & 0xff, b = fb[i] & 0xff;
+    y[i] = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+  }
+  fputs("FRAME\n", capture_fp);
+#else
+  for (int i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    buf[i * 3 + 0] = fb[i] >> 16;
+    buf[i * 3 + 1] = fb[i] >> 8;
+    buf[i * 3 + 2] = fb[i];
+  }
+  fprintf(capture_fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+#endif
+  fwrite(buf, sizeof(buf), 1, capture_fp);
+  // keep the stream up to date for the reader at the other side
+  fflush(capture_fp);
+}
+
+static inline void update_screen() {
+  if (nr_sync ++ % CONFIG_VGA_CAPTURE_INTERVAL != 0) return;
+  uint64_t h = frame_hash();
+  if (nr_capture > 0 && h == last_hash) { nr_dup ++; return; }
+  last_hash = h;
+  nr_capture ++;
+  write_frame();
+}
+#endif
+
+#if !defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_VGA_CAPTURE)
+static void init_screen() {}
+static inline void update_screen() {}
+#endif
+
+#ifndef VMEM_HANDLER
+#define VMEM_HANDLER NULL
+#endif
+
+static void vga_update_screen() {
+  // the guest writes the sync register after drawing a frame
+  if (vgactl_port_base[1]) {
+    update_screen();
+    vgactl_port_base[1] = 0;
+  }
 }
 
 void init_vga() {
@@ -86,7 +286,8 @@ void init_vga() {
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), VMEM_HANDLER);
+  memset(vmem, 0, screen_size());
+  init_screen();
+  event_add("vga", 1000000 / TIMER_HZ, vga_update_screen);
 }
@@ -15,3 +15,7 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+# engines built on translation blocks share the monitor glue of the interpreter,
+# and the JIT runs cold blocks with the superblock engine
+DIRS-$(CONFIG_ENGINE_TB) += src/engine/interpreter
+DIRS-$(CONFIG_ENGINE_JIT) += src/engine/superblock
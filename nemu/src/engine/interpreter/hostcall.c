@@ -14,15 +14,20 @@
 ***************************************************************************************/
 
 #include <utils.h>
+#include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <cpu/tb.h>
+#include <memory/paddr.h>
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret) {
   difftest_skip_ref();
   nemu_state.state = state;
   nemu_state.halt_pc = pc;
   nemu_state.halt_ret = halt_ret;
+  IFDEF(CONFIG_ENGINE_TB, tb_exit_request = true);
+  cpu_post_deadline(0);
 }
 
 __attribute__((noinline))
@@ -49,3 +54,28 @@ void invalid_inst(vaddr_t thispc) {
 
   set_nemu_state(NEMU_ABORT, thispc, -1);
 }
+
+static bool in_direct_pmem(vaddr_t addr, word_t n, int type) {
+  return isa_mmu_check(addr, n, type) == MMU_DIRECT && n <= CONFIG_MSIZE &&
+    in_pmem(addr) && in_pmem(addr + n - 1);
+}
+
+bool hostcall_mem(int op, vaddr_t dst, word_t src, word_t n) {
+  // REF does not know hostcalls, it gets the result from DUT
+  difftest_skip_ref();
+  if (n == 0) return true;
+  // only pmem accessed without the MMU, MMIO and the rest are left to the guest
+  if (!in_direct_pmem(dst, n, MEM_TYPE_WRITE)) return false;
+  if (op != HOSTCALL_MEMSET && !in_direct_pmem(src, n, MEM_TYPE_READ)) return false;
+
+  switch (op) {
+    // overlapping memcpy() is undefined, so it is fine to be memmove()
+    case HOSTCALL_MEMCPY:
+    case HOSTCALL_MEMMOVE: memmove(guest_to_host(dst), guest_to_host(src), n); break;
+    case HOSTCALL_MEMSET:  memset(guest_to_host(dst), src, n); break;
+    default: return false;
+  }
+  pmem_check_code_write(dst, n);
+  difftest_sync_mem(dst, n);
+  return true;
+}
@@ -0,0 +1,401 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/tb.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "x86.h"
+
+#ifndef __x86_64__
+# error The JIT engine only supports x86-64 hosts
+#endif
+
+// Compiled code of a block is a function `int block()', which returns the
+// number of executed instructions and leaves the next pc in cpu.pc.
+//
+// rbx  = &cpu
+// rbp  = host address of guest physical address 0
+// r12-r15 hold the most frequently used guest registers of the block
+// eax, ecx, edx, esi, edi are scratch registers
+
+#define CACHE_SIZE ((size_t)CONFIG_JIT_CACHE_SIZE << 20)
+#define MAX_INST_CODE 512 // upper bound of the code size of one instruction
+#define NR_ALLOC 4
+
+#define GPR_OFF(i) ((int32_t)(offsetof(CPU_state, gpr) + (i) * sizeof(word_t)))
+#define PC_OFF     ((int32_t)offsetof(CPU_state, pc))
+
+static uint8_t *cache = NULL;
+static uint8_t *epilogue = NULL;
+static const int alloc_reg[NR_ALLOC] = { R12, R13, R14, R15 };
+static int alloc_gpr[NR_ALLOC];
+static int host_of[32]; // host register holding a guest register, -1 if none
+
+static uint64_t nr_compile = 0, nr_native = 0;
+
+// --- helpers called by compiled code ---
+
+static vaddr_t jit_interp(Decode *s) {
+  cpu.pc = s->pc;
+  isa_exec_block(s, 1);
+  return s->dnpc;
+}
+
+static word_t jit_div(word_t a, word_t b) {
+  return b == 0 ? -1 : ((sword_t)a == INT32_MIN && (sword_t)b == -1) ? a : (sword_t)a / (sword_t)b;
+}
+static word_t jit_divu(word_t a, word_t b) { return b == 0 ? -1 : a / b; }
+static word_t jit_rem(word_t a, word_t b) {
+  return b == 0 ? a : ((sword_t)a == INT32_MIN && (sword_t)b == -1) ? 0 : (sword_t)a % (sword_t)b;
+}
+static word_t jit_remu(word_t a, word_t b) { return b == 0 ? a : a % b; }
+
+// --- code generation ---
+
+static void load_gpr(int dst, int r) {
+  if (r == 0) x86_alu_rr(ALU_XOR, dst, dst);
+  else if (host_of[r] >= 0) x86_alu_rr(ALU_MOV, dst, host_of[r]);
+  else x86_load(dst, RBX, GPR_OFF(r));
+}
+
+static void store_gpr(int r, int src) {
+  if (r == 0) return;
+  if (host_of[r] >= 0) x86_alu_rr(ALU_MOV, host_of[r], src);
+  else x86_store(RBX, GPR_OFF(r), src);
+}
+
+static void spill() {
+  for (int i = 0; i < NR_ALLOC; i ++) {
+    if (alloc_gpr[i] > 0) x86_store(RBX, GPR_OFF(alloc_gpr[i]), alloc_reg[i]);
+  }
+}
+
+static void reload() {
+  for (int i = 0; i < NR_ALLOC; i ++) {
+    if (alloc_gpr[i] > 0) x86_load(alloc_reg[i], RBX, GPR_OFF(alloc_gpr[i]));
+  }
+}
+
+// leave the block after `nr' instructions, the next pc is in `pc_reg' if it is not -1
+static void emit_exit(int nr, int pc_reg, vaddr_t pc) {
+  spill();
+  if (pc_reg != -1) x86_store(RBX, PC_OFF, pc_reg);
+  else x86_store_imm(RBX, PC_OFF, pc);
+  x86_mov_ri(RAX, nr);
+  x86_patch(x86_jmp(), epilogue);
+}
+
+// leave the block if a helper requests it, e.g. the block is flushed by a store
+static void emit_check_exit_request(int nr, vaddr_t pc) {
+  x86_mov_ri64(RAX, (uintptr_t)&tb_exit_request);
+  x86_cmp_byte_mem(RAX, 0);
+  uint8_t *skip = x86_jcc(CC_E);
+  emit_exit(nr, -1, pc);
+  x86_patch(skip, x86_ptr);
+}
+
+// call vaddr_read() or vaddr_write() of instruction `s', which may reach device
+// callbacks, difftest or a panic, so they see the guest registers and pc in
+// `cpu' as emit_interp() does
+static void emit_call_mem(Decode *s, const void *fn) {
+  spill();
+  x86_store_imm(RBX, PC_OFF, s->pc);
+  x86_call(fn);
+  reload();
+}
+
+// eax = rs1 + imm, and jump to `slow' if it is not an aligned address in pmem
+static void emit_addr(Decode *s, int len, bool check_align, uint8_t **slow) {
+  load_gpr(RAX, s->isa.rs1);
+  if (s->isa.imm != 0) x86_alu_ri(ALU_ADD, RAX, s->isa.imm);
+  int n = 0;
+  if (check_align && len > 1) {
+    x86_alu_rr(ALU_MOV, RDX, RAX);
+    x86_alu_ri(ALU_AND, RDX, len - 1);
+    slow[n ++] = x86_jcc(CC_NE);
+  }
+  x86_alu_rr(ALU_MOV, RDX, RAX);
+  x86_alu_ri(ALU_SUB, RDX, CONFIG_MBASE);
+  x86_alu_ri(ALU_CMP, RDX, CONFIG_MSIZE - len);
+  slow[n ++] = x86_jcc(CC_A);
+  slow[n] = NULL;
+}
+
+static void emit_load(Decode *s, int idx, int len, bool sext) {
+  uint8_t *slow[3];
+  emit_addr(s, len, false, slow);
+  x86_load_idx(len, RCX, RBP, RAX);
+  if (sext) x86_movsx(len, RCX, RCX);
+  store_gpr(s->isa.rd, RCX);
+  uint8_t *done = x86_jmp();
+
+  // device registers and addresses out of pmem
+  for (int i = 0; slow[i] != NULL; i ++) x86_patch(slow[i], x86_ptr);
+  x86_alu_rr(ALU_MOV, RDI, RAX);
+  x86_mov_ri(RSI, len);
+  emit_call_mem(s, vaddr_read);
+  if (sext) x86_movsx(len, RAX, RAX);
+  store_gpr(s->isa.rd, RAX);
+  emit_check_exit_request(idx + 1, s->snpc);
+  x86_patch(done, x86_ptr);
+}
+
+static void emit_store(Decode *s, int idx, int len) {
+  uint8_t *slow[4];
+  emit_addr(s, len, true, slow);
+  load_gpr(RCX, s->isa.rs2);
+  // stores into code pages should be observed by the memory system
+  int n = 0;
+  while (slow[n] != NULL) n ++;
+  x86_shift_ri(SHIFT_SHR, RDX, PAGE_SHIFT);
+  x86_mov_ri64(RSI, (uintptr_t)pmem_code_page);
+  x86_cmp_byte_idx(RSI, RDX, 0);
+  slow[n ++] = x86_jcc(CC_NE);
+  slow[n] = NULL;
+  x86_store_idx(len, RBP, RAX, RCX);
+  uint8_t *done = x86_jmp();
+
+  for (int i = 0; slow[i] != NULL; i ++) x86_patch(slow[i], x86_ptr);
+  x86_alu_rr(ALU_MOV, RDI, RAX);
+  x86_mov_ri(RSI, len);
+  load_gpr(RDX, s->isa.rs2);
+  emit_call_mem(s, vaddr_write);
+  emit_check_exit_request(idx + 1, s->snpc);
+  x86_patch(done, x86_ptr);
+}
+
+static void emit_helper2(const void *fn, Decode *s) {
+  load_gpr(RDI, s->isa.rs1);
+  load_gpr(RSI, s->isa.rs2);
+  x86_call(fn);
+  store_gpr(s->isa.rd, RAX);
+}
+
+// execute the instruction with the interpreter
+static void emit_interp(Decode *s, int idx) {
+  spill();
+  x86_mov_ri64(RDI, (uintptr_t)s);
+  x86_call(jit_interp);
+  reload();
+  x86_alu_ri(ALU_CMP, RAX, s->snpc);
+  uint8_t *skip = x86_jcc(CC_E);
+  emit_exit(idx + 1, RAX, 0);
+  x86_patch(skip, x86_ptr);
+  emit_check_exit_request(idx + 1, s->snpc);
+}
+
+static void emit_setcc_ri(int cc, word_t imm) {
+  x86_alu_ri(ALU_CMP, RAX, imm);
+  x86_setcc(cc, RAX);
+}
+
+// return false if the instruction is left to the interpreter
+static bool emit_op_imm(Decode *s) {
+  uint32_t i = s->isa.inst;
+  int funct3 = BITS(i, 14, 12), funct7 = BITS(i, 31, 25);
+  word_t imm = s->isa.imm;
+  load_gpr(RAX, s->isa.rs1);
+  switch (funct3) {
+    case 0: x86_alu_ri(ALU_ADD, RAX, imm); break;
+    case 2: emit_setcc_ri(CC_L, imm); break;
+    case 3: emit_setcc_ri(CC_B, imm); break;
+    case 4: x86_alu_ri(ALU_XOR, RAX, imm); break;
+    case 6: x86_alu_ri(ALU_OR,  RAX, imm); break;
+    case 7: x86_alu_ri(ALU_AND, RAX, imm); break;
+    case 1: if (funct7 != 0) return false;
+            x86_shift_ri(SHIFT_SHL, RAX, imm & 0x1f); break;
+    case 5: if (funct7 != 0 && funct7 != 0x20) return false;
+            x86_shift_ri(funct7 ? SHIFT_SAR : SHIFT_SHR, RAX, imm & 0x1f); break;
+  }
+  store_gpr(s->isa.rd, RAX);
+  return true;
+}
+
+static bool emit_op(Decode *s) {
+  uint32_t i = s->isa.inst;
+  int funct3 = BITS(i, 14, 12), funct7 = BITS(i, 31, 25);
+  if (funct7 == 1) {
+    switch (funct3) {
+      case 4: emit_helper2(jit_div,  s); return true;
+      case 5: emit_helper2(jit_divu, s); return true;
+      case 6: emit_helper2(jit_rem,  s); return true;
+      case 7: emit_helper2(jit_remu, s); return true;
+    }
+  }
+  if (funct7 == 0x20 && funct3 != 0 && funct3 != 5) return false;
+  if (funct7 != 0 && funct7 != 0x20 && funct7 != 1) return false;
+
+  load_gpr(RAX, s->isa.rs1);
+  load_gpr(RCX, s->isa.rs2);
+  if (funct7 == 1) {
+    switch (funct3) {
+      case 0: x86_imul_rr(RAX, RCX); break;
+      case 1: x86_movsxd(RAX, RAX); x86_movsxd(RCX, RCX); // mulh
+              x86_imul_rr64(RAX, RCX); x86_shr64_ri(RAX, 32); break;
+      case 2: x86_movsxd(RAX, RAX); // mulhsu, rcx is zero extended
+              x86_imul_rr64(RAX, RCX); x86_shr64_ri(RAX, 32); break;
+      case 3: x86_imul_rr64(RAX, RCX); x86_shr64_ri(RAX, 32); break; // mulhu
+    }
+  } else {
+    switch (funct3) {
+      case 0: x86_alu_rr(funct7 ? ALU_SUB : ALU_ADD, RAX, RCX); break;
+      case 1: x86_shift_rcl(SHIFT_SHL, RAX); break;
+      case 2: x86_alu_rr(ALU_CMP, RAX, RCX); x86_setcc(CC_L, RAX); break;
+      case 3: x86_alu_rr(ALU_CMP, RAX, RCX); x86_setcc(CC_B, RAX); break;
+      case 4: x86_alu_rr(ALU_XOR, RAX, RCX); break;
+      case 5: x86_shift_rcl(funct7 ? SHIFT_SAR : SHIFT_SHR, RAX); break;
+      case 6: x86_alu_rr(ALU_OR,  RAX, RCX); break;
+      case 7: x86_alu_rr(ALU_AND, RAX, RCX); break;
+    }
+  }
+  store_gpr(s->isa.rd, RAX);
+  return true;
+}
+
+// return true if the control flow leaves the block at this instruction
+static bool emit_inst(Decode *s, int idx, bool last) {
+  static const int branch_cc[8] = { CC_E, CC_NE, -1, -1, CC_L, CC_GE, CC_B, CC_AE };
+  static const int load_len[8] = { 1, 2, 4, 0, 1, 2, 0, 0 };
+  uint32_t i = s->isa.inst;
+  int funct3 = BITS(i, 14, 12);
+  bool ok = true;
+
+  switch (BITS(i, 6, 0)) {
+    case 0b0110111: x86_mov_ri(RAX, s->isa.imm); store_gpr(s->isa.rd, RAX); break; // lui
+    case 0b0010111: x86_mov_ri(RAX, s->pc + s->isa.imm); store_gpr(s->isa.rd, RAX); break; // auipc
+    case 0b1101111: // jal, the following instruction in the block is the target
+      x86_mov_ri(RAX, s->snpc);
+      store_gpr(s->isa.rd, RAX);
+      if (last) emit_exit(idx + 1, -1, s->pc + s->isa.imm);
+      return last;
+    case 0b1100111: // jalr
+      if (funct3 != 0) { ok = false; break; }
+      load_gpr(RDX, s->isa.rs1);
+      x86_alu_ri(ALU_ADD, RDX, s->isa.imm);
+      x86_alu_ri(ALU_AND, RDX, ~(word_t)1);
+      x86_mov_ri(RAX, s->snpc);
+      store_gpr(s->isa.rd, RAX);
+      emit_exit(idx + 1, RDX, 0);
+      return true;
+    case 0b1100011: { // branch, the following instruction in the block is the fall-through one
+      if (branch_cc[funct3] == -1) { ok = false; break; }
+      load_gpr(RAX, s->isa.rs1);
+      load_gpr(RCX, s->isa.rs2);
+      x86_alu_rr(ALU_CMP, RAX, RCX);
+      uint8_t *skip = x86_jcc(branch_cc[funct3] ^ 1);
+      emit_exit(idx + 1, -1, s->pc + s->isa.imm);
+      x86_patch(skip, x86_ptr);
+      break;
+    }
+    case 0b0000011:
+      if (load_len[funct3] == 0) { ok = false; break; }
+      emit_load(s, idx, load_len[funct3], funct3 < 2);
+      break;
+    case 0b0100011:
+      if (funct3 > 2) { ok = false; break; }
+      emit_store(s, idx, 1 << funct3);
+      break;
+    case 0b0010011: ok = emit_op_imm(s); break;
+    case 0b0110011: ok = emit_op(s); break;
+    case 0b0001111: ok = (funct3 == 0); break; // fence
+    default: ok = false; break;
+  }
+  if (!ok) emit_interp(s, idx);
+
+  if (last) emit_exit(idx + 1, -1, s->snpc);
+  return last;
+}
+
+// keep the most frequently used guest registers in host registers
+static void alloc_regs(TB *tb) {
+  int count[32] = {};
+  for (int k = 0; k < tb->nr_inst; k ++) {
+    ISADecodeInfo *isa = &tb->inst[k].isa;
+    int opcode = BITS(isa->inst, 6, 0);
+    count[isa->rs1] ++;
+    count[isa->rs2] ++;
+    if (opcode != 0b1100011 && opcode != 0b0100011) count[isa->rd] ++;
+  }
+  count[0] = 0;
+  for (int r = 0; r < 32; r ++) host_of[r] = -1;
+  for (int k = 0; k < NR_ALLOC; k ++) {
+    int best = 0;
+    for (int r = 1; r < 32; r ++) {
+      if (host_of[r] == -1 && count[r] > count[best]) best = r;
+    }
+    alloc_gpr[k] = (count[best] >= 2 ? best : 0);
+    if (alloc_gpr[k] != 0) host_of[best] = alloc_reg[k];
+  }
+}
+
+static void emit_epilogue() {
+  epilogue = x86_ptr;
+  x86_adjust_rsp(8);
+  x86_pop(R15); x86_pop(R14); x86_pop(R13); x86_pop(R12);
+  x86_pop(RBP); x86_pop(RBX);
+  x86_ret();
+}
+
+static void emit_prologue() {
+  x86_push(RBX); x86_push(RBP);
+  x86_push(R12); x86_push(R13); x86_push(R14); x86_push(R15);
+  x86_adjust_rsp(-8); // keep rsp 16-byte aligned for helper calls
+  x86_mov_ri64(RBX, (uintptr_t)&cpu);
+  x86_mov_ri64(RBP, (uintptr_t)guest_to_host(CONFIG_MBASE) - CONFIG_MBASE);
+  reload();
+}
+
+void jit_flush() {
+  if (cache == NULL) return;
+  x86_ptr = cache;
+  emit_epilogue();
+}
+
+void jit_compile(TB *tb) {
+  if (cache == NULL) {
+    cache = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(cache != MAP_FAILED, "fail to allocate the code cache");
+    jit_flush();
+  }
+  if (x86_ptr + (tb->nr_inst + 1) * MAX_INST_CODE > cache + CACHE_SIZE) {
+    // the block is stale after flushing, and will be translated again
+    tb_flush();
+    return;
+  }
+
+  alloc_regs(tb);
+  uint8_t *entry = x86_ptr;
+  emit_prologue();
+  for (int k = 0; k < tb->nr_inst; k ++) {
+    if (emit_inst(&tb->inst[k], k, k == tb->nr_inst - 1)) break;
+  }
+  tb->code = entry;
+  nr_compile ++;
+}
+
+int jit_exec(TB *tb) {
+  nr_native ++;
+  return ((int (*)())tb->code)();
+}
+
+void jit_statistic() {
+  Log("jit: compiled = %" PRIu64 ", native runs = %" PRIu64 ", code cache used = %zu KB",
+      nr_compile, nr_native, cache == NULL ? 0 : (size_t)(x86_ptr - cache) >> 10);
+}
@@ -0,0 +1,190 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __X86_H__
+#define __X86_H__
+
+#include <common.h>
+
+// A minimal x86-64 instruction emitter for the JIT. Unless noted,
+// instructions operate on 32-bit registers, and memory operands are
+// [base + disp32] or [base + index].
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+       CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+
+// ALU opcodes in the form of `op r/m32, r32', and the /ext of `op r/m32, imm32'
+enum { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29,
+       ALU_XOR = 0x31, ALU_CMP = 0x39, ALU_MOV = 0x89 };
+enum { SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7 };
+
+static uint8_t *x86_ptr = NULL;
+
+static inline void emit8(uint8_t v) { *x86_ptr ++ = v; }
+static inline void emit32(uint32_t v) { memcpy(x86_ptr, &v, 4); x86_ptr += 4; }
+static inline void emit64(uint64_t v) { memcpy(x86_ptr, &v, 8); x86_ptr += 8; }
+
+static inline void emit_rex(int w, int reg, int index, int base) {
+  uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+  if (rex != 0x40) emit8(rex);
+}
+
+static inline void emit_modrm(int mod, int reg, int rm) {
+  emit8((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// [base + disp32]
+static inline void emit_mem(int reg, int base, int32_t disp) {
+  emit_modrm(2, reg, base);
+  if ((base & 7) == RSP) emit8(0x24);
+  emit32(disp);
+}
+
+// [base + index]
+static inline void emit_mem_idx(int reg, int base, int index) {
+  // mod = 1 with disp8 = 0, since mod = 0 with base = rbp/r13 means no base
+  emit_modrm(1, reg, RSP);
+  emit8(((index & 7) << 3) | (base & 7));
+  emit8(0);
+}
+
+// op dst, src
+static inline void x86_alu_rr(int op, int dst, int src) {
+  emit_rex(0, src, 0, dst); emit8(op); emit_modrm(3, src, dst);
+}
+
+// op dst, imm32
+static inline void x86_alu_ri(int op, int dst, uint32_t imm) {
+  emit_rex(0, 0, 0, dst); emit8(0x81); emit_modrm(3, op >> 3, dst); emit32(imm);
+}
+
+static inline void x86_mov_ri(int dst, uint32_t imm) {
+  emit_rex(0, 0, 0, dst); emit8(0xb8 + (dst & 7)); emit32(imm);
+}
+
+static inline void x86_mov_ri64(int dst, uint64_t imm) {
+  emit_rex(1, 0, 0, dst); emit8(0xb8 + (dst & 7)); emit64(imm);
+}
+
+static inline void x86_load(int dst, int base, int32_t disp) {
+  emit_rex(0, dst, 0, base); emit8(0x8b); emit_mem(dst, base, disp);
+}
+
+static inline void x86_store(int base, int32_t disp, int src) {
+  emit_rex(0, src, 0, base); emit8(0x89); emit_mem(src, base, disp);
+}
+
+// mov dword [base + disp32], imm32
+static inline void x86_store_imm(int base, int32_t disp, uint32_t imm) {
+  emit_rex(0, 0, 0, base); emit8(0xc7); emit_mem(0, base, disp); emit32(imm);
+}
+
+// load `len' bytes from [base + index] into dst, with zero extension
+static inline void x86_load_idx(int len, int dst, int base, int index) {
+  emit_rex(0, dst, index, base);
+  switch (len) {
+    case 1: emit8(0x0f); emit8(0xb6); break;
+    case 2: emit8(0x0f); emit8(0xb7); break;
+    default: emit8(0x8b); break;
+  }
+  emit_mem_idx(dst, base, index);
+}
+
+// store the low `len' bytes of src into [base + index], src should be eax/ecx/edx/ebx
+static inline void x86_store_idx(int len, int base, int index, int src) {
+  if (len == 2) emit8(0x66);
+  emit_rex(0, src, index, base);
+  emit8(len == 1 ? 0x88 : 0x89);
+  emit_mem_idx(src, base, index);
+}
+
+// cmp byte [base], imm8
+static inline void x86_cmp_byte_mem(int base, uint8_t imm) {
+  emit_rex(0, 0, 0, base); emit8(0x80); emit_modrm(0, 7, base); emit8(imm);
+}
+
+// cmp byte [base + index], imm8
+static inline void x86_cmp_byte_idx(int base, int index, uint8_t imm) {
+  emit_rex(0, 0, index, base); emit8(0x80); emit_mem_idx(7, base, index); emit8(imm);
+}
+
+// sign extend the low 8 or 16 bits of src into dst
+static inline void x86_movsx(int len, int dst, int src) {
+  emit_rex(0, dst, 0, src); emit8(0x0f); emit8(len == 1 ? 0xbe : 0xbf); emit_modrm(3, dst, src);
+}
+
+static inline void x86_shift_ri(int ext, int dst, uint8_t imm) {
+  emit_rex(0, 0, 0, dst); emit8(0xc1); emit_modrm(3, ext, dst); emit8(imm);
+}
+
+// shift by cl
+static inline void x86_shift_rcl(int ext, int dst) {
+  emit_rex(0, 0, 0, dst); emit8(0xd3); emit_modrm(3, ext, dst);
+}
+
+static inline void x86_imul_rr(int dst, int src) {
+  emit_rex(0, dst, 0, src); emit8(0x0f); emit8(0xaf); emit_modrm(3, dst, src);
+}
+
+// 64-bit multiplication
+static inline void x86_imul_rr64(int dst, int src) {
+  emit_rex(1, dst, 0, src); emit8(0x0f); emit8(0xaf); emit_modrm(3, dst, src);
+}
+
+// sign extend a 32-bit register to 64 bits
+static inline void x86_movsxd(int dst, int src) {
+  emit_rex(1, dst, 0, src); emit8(0x63); emit_modrm(3, dst, src);
+}
+
+static inline void x86_shr64_ri(int dst, uint8_t imm) {
+  emit_rex(1, 0, 0, dst); emit8(0xc1); emit_modrm(3, SHIFT_SHR, dst); emit8(imm);
+}
+
+// dst = (condition cc holds), dst should be eax/ecx/edx/ebx
+static inline void x86_setcc(int cc, int dst) {
+  emit8(0x0f); emit8(0x90 + cc); emit_modrm(3, 0, dst);
+  emit8(0x0f); emit8(0xb6); emit_modrm(3, dst, dst);
+}
+
+static inline void x86_push(int r) { emit_rex(0, 0, 0, r); emit8(0x50 + (r & 7)); }
+static inline void x86_pop(int r) { emit_rex(0, 0, 0, r); emit8(0x58 + (r & 7)); }
+static inline void x86_ret() { emit8(0xc3); }
+
+// add/sub rsp, imm8
+static inline void x86_adjust_rsp(int8_t imm) {
+  emit8(0x48); emit8(0x83); emit_modrm(3, imm < 0 ? 5 : 0, RSP); emit8(imm < 0 ? -imm : imm);
+}
+
+static inline void x86_call(const void *fn) {
+  x86_mov_ri64(RAX, (uintptr_t)fn);
+  emit8(0xff); emit_modrm(3, 2, RAX);
+}
+
+// jumps with rel32, return the address of rel32 for patching
+static inline uint8_t* x86_jcc(int cc) {
+  emit8(0x0f); emit8(0x80 + cc); emit32(0); return x86_ptr - 4;
+}
+
+static inline uint8_t* x86_jmp() {
+  emit8(0xe9); emit32(0); return x86_ptr - 4;
+}
+
+static inline void x86_patch(uint8_t *rel32, const uint8_t *target) {
+  int32_t off = target - (rel32 + 4);
+  memcpy(rel32, &off, 4);
+}
+
+#endif
@@ -0,0 +1,159 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/tb.h>
+#include <memory/paddr.h>
+
+#define TB_MAX_INST 64
+#define NR_TB       16384
+#define NR_DECODE   (NR_TB * 4)
+#define NR_BUCKET   4096
+
+static TB tb_pool[NR_TB];
+static Decode decode_pool[NR_DECODE];
+static TB *bucket[NR_BUCKET];
+static int nr_tb = 0, nr_decode = 0;
+
+// one bit for each pmem word covered by a translated instruction
+static uint32_t code_map[CONFIG_MSIZE / 4 / 32];
+
+// set when the blocks are flushed, so that the stale block
+// held by the engine is not chained to any block
+static bool flushed = false;
+bool tb_exit_request = false;
+
+static uint64_t nr_translate = 0, nr_flush = 0, nr_lookup = 0, nr_chain = 0;
+
+static inline int tb_hash(vaddr_t pc) { return (pc >> 2) & (NR_BUCKET - 1); }
+
+static inline uint32_t code_word(paddr_t paddr) { return (paddr - CONFIG_MBASE) >> 2; }
+
+// only instructions fetched from pmem are translated,
+// since stores into them are observed by the memory system
+static bool tb_translatable(vaddr_t pc) {
+  return isa_mmu_check(pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT && in_pmem(pc);
+}
+
+void tb_flush() {
+  memset(bucket, 0, sizeof(bucket));
+  memset(code_map, 0, sizeof(code_map));
+  nr_tb = nr_decode = 0;
+  flushed = true;
+  nr_flush ++;
+  IFDEF(CONFIG_ENGINE_JIT, jit_flush());
+}
+
+// called by the memory system when a code page is written
+void tb_invalidate(paddr_t paddr, int len) {
+  for (uint32_t w = code_word(paddr); w <= code_word(paddr + len - 1); w ++) {
+    if (code_map[w / 32] & (1u << (w % 32))) {
+      tb_flush();
+      tb_exit_request = true;
+      return;
+    }
+  }
+}
+
+static TB* tb_translate(vaddr_t pc) {
+  if (!tb_translatable(pc)) return NULL;
+  if (nr_tb == NR_TB || nr_decode + TB_MAX_INST > NR_DECODE) tb_flush();
+
+  TB *tb = &tb_pool[nr_tb ++];
+  tb->pc = pc;
+  tb->nr_inst = 0;
+  tb->inst = &decode_pool[nr_decode];
+  tb->succ[0] = tb->succ[1] = NULL;
+  IFDEF(CONFIG_ENGINE_JIT, tb->code = NULL);
+  IFDEF(CONFIG_ENGINE_JIT, tb->nr_exec = 0);
+
+  while (true) {
+    Decode *s = &tb->inst[tb->nr_inst ++];
+    s->pc = pc;
+    s->snpc = pc;
+    int end = isa_decode_once(s);
+
+    pmem_mark_code_page(s->pc, s->snpc - s->pc);
+    for (uint32_t w = code_word(s->pc); w <= code_word(s->snpc - 1); w ++) {
+      code_map[w / 32] |= 1u << (w % 32);
+    }
+
+    if (end == TB_END_INDIRECT || end == TB_END_STOP || tb->nr_inst == TB_MAX_INST) break;
+    // continue along the fall-through path of branches and the target of jumps
+    pc = (end == TB_END_JUMP ? s->dnpc : s->snpc);
+    if (!tb_translatable(pc)) break;
+  }
+  nr_decode += tb->nr_inst;
+  IFDEF(CONFIG_FUSION, isa_fuse_block(tb->inst, tb->nr_inst));
+
+  int idx = tb_hash(tb->pc);
+  tb->next = bucket[idx];
+  bucket[idx] = tb;
+  nr_translate ++;
+  return tb;
+}
+
+TB* tb_find(TB *prev, vaddr_t pc) {
+  if (prev != NULL && !flushed) {
+    if (prev->succ[0] != NULL && prev->succ[0]->pc == pc) { nr_chain ++; return prev->succ[0]; }
+    if (prev->succ[1] != NULL && prev->succ[1]->pc == pc) {
+      TB *tb = prev->succ[1];
+      prev->succ[1] = prev->succ[0];
+      prev->succ[0] = tb;
+      nr_chain ++;
+      return tb;
+    }
+  }
+
+  nr_lookup ++;
+  TB *tb;
+  for (tb = bucket[tb_hash(pc)]; tb != NULL; tb = tb->next) {
+    if (tb->pc == pc) break;
+  }
+  if (tb == NULL) {
+    tb = tb_translate(pc);
+    if (tb == NULL) return NULL;
+  }
+
+  if (prev != NULL && !flushed) {
+    prev->succ[1] = prev->succ[0];
+    prev->succ[0] = tb;
+  }
+  flushed = false;
+  return tb;
+}
+
+// Execute at most `n' instructions of `tb', and return the number of executed ones.
+int tb_exec(TB *tb, int n) {
+  tb_exit_request = false;
+#ifdef CONFIG_ENGINE_JIT
+  // compiled code always runs through a whole block
+  if (n >= tb->nr_inst) {
+    if (tb->code == NULL && ++ tb->nr_exec == CONFIG_JIT_THRESHOLD) jit_compile(tb);
+    if (tb->code != NULL) return jit_exec(tb);
+  }
+#endif
+  cpu.pc = tb->pc;
+  int nr = isa_exec_block(tb->inst, n < tb->nr_inst ? n : tb->nr_inst);
+  cpu.pc = tb->inst[nr - 1].dnpc;
+  return nr;
+}
+
+void tb_statistic() {
+  Log("superblock: translated = %" PRIu64 ", flushes = %" PRIu64 ", chained = %" PRIu64
+      ", looked up = %" PRIu64, nr_translate, nr_flush, nr_chain, nr_lookup);
+  IFDEF(CONFIG_ENGINE_JIT, jit_statistic());
+}
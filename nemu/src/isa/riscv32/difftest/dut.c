@@ -18,7 +18,11 @@
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  return false;
+  bool ok = difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
+  for (int i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    ok &= difftest_check_reg(reg_name(i), pc, ref_r->gpr[i], gpr(i));
+  }
+  return ok;
 }
 
 void isa_difftest_attach() {
@@ -21,13 +21,29 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  struct {
+    word_t mstatus, mie, mtvec, mscratch, mepc, mcause, mtval, satp;
+  } csr;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
 typedef struct {
   uint32_t inst;
+#ifdef CONFIG_RVC
+  uint16_t cinst; // the compressed encoding if ilen == 2, `inst' is its expansion
+  uint8_t ilen;
+#endif
+  // The operands are resolved into register indices instead of register values,
+  // so that a decoded instruction can be executed again without being decoded.
+  const void *handler; // the execute body of the matched pattern
+#ifdef CONFIG_FUSION
+  const void *plain_handler; // the execute body of the instruction alone if `handler' runs a fused pair
+#endif
+  uint8_t rd, rs1, rs2;
+  word_t imm;
 } MUXDEF(CONFIG_RV64, riscv64_ISADecodeInfo, riscv32_ISADecodeInfo);
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+// addresses are translated with Sv32 when satp.MODE is set, in all privilege modes
+#define isa_mmu_check(vaddr, len, type) ((cpu.csr.satp >> 31) ? MMU_TRANSLATE : MMU_DIRECT)
 
 #endif
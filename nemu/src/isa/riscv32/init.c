@@ -32,12 +32,21 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Only machine mode is supported. */
+  cpu.csr.mstatus = 0x1800;
 }
 
+void init_decode_cache();
+void init_rvc();
+
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
   /* Initialize this virtual computer system. */
   restart();
+
+  IFDEF(CONFIG_DECODE_CACHE, init_decode_cache());
+  IFDEF(CONFIG_RVC, init_rvc());
 }
@@ -13,66 +13,405 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+
 #include "local-include/reg.h"
+#include "local-include/rvc.h"
+#include "local-include/csr.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <memory/cache.h>
+#include <cpu/tb.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_I, TYPE_U, TYPE_S, TYPE_B, TYPE_J, TYPE_R,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
-#define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
-#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
-#define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+// csrrw, csrrs and csrrc: write `val' computed from the old value `t' if `wen'
+#define CSRRW(val, wen) do { \
+  int addr = BITS(s->isa.inst, 31, 20); \
+  if (!csr_check(addr, wen)) { INV(s->pc); break; } \
+  word_t t = csr_read(addr); \
+  if (wen) csr_write(addr, val); \
+  R(rd) = t; \
+} while (0)
+
+#define src1R() do { s->isa.rs1 = rs1; } while (0)
+#define src2R() do { s->isa.rs2 = rs2; } while (0)
+#define immI() do { s->isa.imm = SEXT(BITS(i, 31, 20), 12); } while(0)
+#define immU() do { s->isa.imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
+#define immS() do { s->isa.imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immB() do { s->isa.imm = (SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) | \
+                              (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1); } while(0)
+#define immJ() do { s->isa.imm = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | \
+                              (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+// Fetch the instruction at s->pc. Compressed instructions are expanded
+// to their 32-bit equivalents through the table built by init_rvc().
+static inline void fetch_inst(Decode *s) {
+#ifdef CONFIG_RVC
+  // the instruction cache sees one fetch of the whole instruction,
+  // the same as on a decode-cache hit
+  IFDEF(CONFIG_CACHESIM, cache_bypass = true);
+  uint32_t lo = inst_fetch(&s->snpc, 2);
+  if (rvc_is_compressed(lo)) {
+    s->isa.cinst = lo;
+    s->isa.inst = rvc_table[lo];
+    s->isa.ilen = 2;
+  } else {
+    s->isa.inst = lo | (inst_fetch(&s->snpc, 2) << 16);
+    s->isa.ilen = 4;
+  }
+  IFDEF(CONFIG_CACHESIM, cache_bypass = false; vaddr_ifetch(s->pc, s->isa.ilen));
+#else
+  s->isa.inst = inst_fetch(&s->snpc, 4);
+#endif
+}
+
+static void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst;
   int rs1 = BITS(i, 19, 15);
   int rs2 = BITS(i, 24, 20);
-  *rd     = BITS(i, 11, 7);
+  // unused source operands read $zero
+  s->isa.rs1 = s->isa.rs2 = 0;
+  s->isa.imm = 0;
+  s->isa.rd  = BITS(i, 11, 7);
   switch (type) {
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_B: src1R(); src2R(); immB(); break;
+    case TYPE_J:                   immJ(); break;
+    case TYPE_R: src1R(); src2R();         break;
     case TYPE_N: break;
     default: panic("unsupported type = %d", type);
   }
 }
 
-static int decode_exec(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+#define DCACHE_NR CONFIG_DECODE_CACHE_SIZE
+// instructions are aligned to 2 bytes with the C extension
+#define INST_ALIGN MUXDEF(CONFIG_RVC, 2, 4)
+#define dcache_index(pc) (((pc) / INST_ALIGN) & (DCACHE_NR - 1))
+static_assert((DCACHE_NR & (DCACHE_NR - 1)) == 0, "decode cache size should be a power of 2");
+
+typedef struct {
+  vaddr_t pc;
+  ISADecodeInfo isa;
+} DecodeCacheEntry;
+
+static DecodeCacheEntry dcache[DCACHE_NR];
+static uint64_t dcache_hit = 0, dcache_miss = 0;
+
+void init_decode_cache() {
+  for (int i = 0; i < DCACHE_NR; i ++) {
+    dcache[i].pc = (vaddr_t)-1; // never matches an aligned pc
+  }
+}
+
+// called by the memory system when a code page is written
+void decode_cache_invalidate(paddr_t paddr, int len) {
+  // only identity-mapped instructions are cached, so the entry of the
+  // overwritten instruction can be located by the physical address
+  // a 4-byte instruction may start 2 bytes before `paddr' with the C extension
+  paddr_t start = (paddr & ~(paddr_t)(INST_ALIGN - 1)) - (4 - INST_ALIGN);
+  for (paddr_t p = start; p < paddr + len; p += INST_ALIGN) {
+    DecodeCacheEntry *e = &dcache[dcache_index(p)];
+    if (e->pc == p) e->pc = (vaddr_t)-1;
+  }
+}
+
+void decode_cache_statistic() {
+  uint64_t total = dcache_hit + dcache_miss;
+  Log("decode cache: hit = %" PRIu64 ", miss = %" PRIu64 ", hit rate = %.2f%%",
+      dcache_hit, dcache_miss, total == 0 ? 0.0 : dcache_hit * 100.0 / total);
+}
+#endif
+
+#ifdef CONFIG_FUSION
+// pairs of adjacent instructions executed by one execute body
+enum {
+  FUSE_LI,          // lui rd, hi; addi rd, rd, lo
+  FUSE_AUIPC_JALR,  // auipc rd, hi; jalr rd', lo(rd)
+  FUSE_AUIPC_LW,    // auipc rd, hi; lw rd', lo(rd)
+  FUSE_SLT_BRANCH,  // slt[i][u] rd, ...; beqz/bnez rd
+  NR_FUSION
+};
+static const char *fusion_name[NR_FUSION] = {
+  "lui+addi", "auipc+jalr", "auipc+lw", "slt+beqz/bnez",
+};
+static uint64_t fusion_hit[NR_FUSION] = {};
+static const void * const *fusion_handler = NULL;
+#endif
+
+// Execute `n' instructions starting from `s', decoding them if necessary.
+// The execute body of one instruction dispatches the next one directly,
+// until the control flow leaves the sequence. With `n' = 0, the instruction
+// in `s' is only decoded. Return the number of executed instructions.
+__attribute__((noinline))
+static int decode_exec(Decode *s, int n) {
+  Decode *start = s;
+  int rd;
+  word_t src1, src2, imm;
+
+#ifdef CONFIG_FUSION
+  static const void * const fusion_table[NR_FUSION] = {
+    [FUSE_LI] = &&fuse_li, [FUSE_AUIPC_JALR] = &&fuse_auipc_jalr,
+    [FUSE_AUIPC_LW] = &&fuse_auipc_lw, [FUSE_SLT_BRANCH] = &&fuse_slt_branch,
+  };
+  if (n == 0) fusion_handler = fusion_table;
+#endif
+
+  // declared before the cached execute bodies are jumped to
+  INSTPAT_DECLARE();
+
+dispatch:
   s->dnpc = s->snpc;
 
+  // the instruction is already decoded, jump to its execute body directly
+  if (s->isa.handler != NULL) goto *s->isa.handler;
+
 #define INSTPAT_INST(s) ((s)->isa.inst)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  int rd = 0; \
-  word_t src1 = 0, src2 = 0, imm = 0; \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  decode_operand(s, concat(TYPE_, type)); \
+  s->isa.handler = &&concat(__instpat_exec_, __LINE__); \
+  if (n == 0) return 0; \
+concat(__instpat_exec_, __LINE__): \
+  rd = s->isa.rd; \
+  src1 = R(s->isa.rs1); src2 = R(s->isa.rs2); imm = s->isa.imm; \
   __VA_ARGS__ ; \
 }
 
-  INSTPAT_START();
+  INSTPAT_BEGIN();
+  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(rd) = imm);
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
+
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(rd) = s->snpc; s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(rd) = s->snpc; s->dnpc = (src1 + imm) & ~(word_t)1);
+  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, if (src1 == src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, if (src1 != src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, if ((sword_t)src1 <  (sword_t)src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, if ((sword_t)src1 >= (sword_t)src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, if (src1 <  src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, if (src1 >= src2) s->dnpc = s->pc + imm);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb     , I, R(rd) = SEXT(Mr(src1 + imm, 1), 8));
+  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh     , I, R(rd) = SEXT(Mr(src1 + imm, 2), 16));
+  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(rd) = SEXT(Mr(src1 + imm, 4), 32));
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
+  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu    , I, R(rd) = Mr(src1 + imm, 2));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
+  INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, src2));
+  INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
+
+  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi   , I, R(rd) = src1 + imm);
+  INSTPAT("??????? ????? ????? 010 ????? 00100 11", slti   , I, R(rd) = (sword_t)src1 < (sword_t)imm);
+  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu  , I, R(rd) = src1 < imm);
+  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori   , I, R(rd) = src1 ^ imm);
+  INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori    , I, R(rd) = src1 | imm);
+  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi   , I, R(rd) = src1 & imm);
+  INSTPAT("0000000 ????? ????? 001 ????? 00100 11", slli   , I, R(rd) = src1 << BITS(imm, 4, 0));
+  INSTPAT("0000000 ????? ????? 101 ????? 00100 11", srli   , I, R(rd) = src1 >> BITS(imm, 4, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 00100 11", srai   , I, R(rd) = (sword_t)src1 >> BITS(imm, 4, 0));
+
+  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add    , R, R(rd) = src1 + src2);
+  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub    , R, R(rd) = src1 - src2);
+  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll    , R, R(rd) = src1 << BITS(src2, 4, 0));
+  INSTPAT("0000000 ????? ????? 010 ????? 01100 11", slt    , R, R(rd) = (sword_t)src1 < (sword_t)src2);
+  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu   , R, R(rd) = src1 < src2);
+  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor    , R, R(rd) = src1 ^ src2);
+  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl    , R, R(rd) = src1 >> BITS(src2, 4, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra    , R, R(rd) = (sword_t)src1 >> BITS(src2, 4, 0));
+  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or     , R, R(rd) = src1 | src2);
+  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and    , R, R(rd) = src1 & src2);
+
+  INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul    , R, R(rd) = src1 * src2);
+  INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh   , R, R(rd) = ((int64_t)(sword_t)src1 * (int64_t)(sword_t)src2) >> 32);
+  INSTPAT("0000001 ????? ????? 010 ????? 01100 11", mulhsu , R, R(rd) = ((int64_t)(sword_t)src1 * (int64_t)(uint64_t)src2) >> 32);
+  INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu  , R, R(rd) = ((uint64_t)src1 * (uint64_t)src2) >> 32);
+  INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div    , R, R(rd) = src2 == 0 ? -1 :
+      ((sword_t)src1 == INT32_MIN && (sword_t)src2 == -1) ? src1 : (sword_t)src1 / (sword_t)src2);
+  INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu   , R, R(rd) = src2 == 0 ? -1 : src1 / src2);
+  INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem    , R, R(rd) = src2 == 0 ? src1 :
+      ((sword_t)src1 == INT32_MIN && (sword_t)src2 == -1) ? 0 : (sword_t)src1 % (sword_t)src2);
+  INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu   , R, R(rd) = src2 == 0 ? src1 : src1 % src2);
 
+  INSTPAT("??????? ????? ????? 000 ????? 00011 11", fence  , N, );
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, CSRRW(src1, true));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, CSRRW(t | src1, s->isa.rs1 != 0));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, CSRRW(t & ~src1, s->isa.rs1 != 0));
+  // the immediate is in the rs1 field
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, CSRRW(s->isa.rs1, true));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, CSRRW(t | s->isa.rs1, s->isa.rs1 != 0));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, CSRRW(t & ~(word_t)s->isa.rs1, s->isa.rs1 != 0));
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(EXC_ECALL_M, s->pc));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = intr_mret());
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence_vma, N, mmu_flush(false));
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  // NEMU hostcalls in the custom-0 space, with operands in $a0-$a2, set $a0 to 1 if done
+  INSTPAT("0000000 00000 00000 000 00000 00010 11", hmemcpy , N, R(10) = hostcall_mem(HOSTCALL_MEMCPY , R(10), R(11), R(12)));
+  INSTPAT("0000000 00000 00000 001 00000 00010 11", hmemset , N, R(10) = hostcall_mem(HOSTCALL_MEMSET , R(10), R(11), R(12)));
+  INSTPAT("0000000 00000 00000 010 00000 00010 11", hmemmove, N, R(10) = hostcall_mem(HOSTCALL_MEMMOVE, R(10), R(11), R(12)));
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
+#ifdef CONFIG_FUSION
+finish:
+#endif
   R(0) = 0; // reset $zero to 0
 
-  return 0;
+  s ++;
+  if (s < start + n && s[-1].dnpc == s->pc &&
+      MUXDEF(CONFIG_ENGINE_TB, !tb_exit_request, true)) {
+    cpu.pc = s->pc;
+    goto dispatch;
+  }
+  return s - start;
+
+#ifdef CONFIG_FUSION
+  // The execute bodies of fused pairs. They are entered with `s' pointing
+  // to the first instruction, and leave with `s' pointing to the second one.
+  // A pair cut by the end of the sequence is executed as two instructions
+  // this time, and stays fused for the next time.
+#define FUSION(name, id, ... /* execute body */) \
+name: \
+  if (unlikely(s + 1 == start + n)) goto *s->isa.plain_handler; \
+  fusion_hit[id] ++; \
+  { __VA_ARGS__; } \
+  goto finish;
+
+  FUSION(fuse_li, FUSE_LI,
+    R(s->isa.rd) = s->isa.imm + s[1].isa.imm;
+    s ++; s->dnpc = s->snpc);
+  FUSION(fuse_auipc_jalr, FUSE_AUIPC_JALR,
+    src1 = s->pc + s->isa.imm; R(s->isa.rd) = src1;
+    s ++; s->dnpc = (src1 + s->isa.imm) & ~(word_t)1; R(s->isa.rd) = s->snpc);
+  FUSION(fuse_auipc_lw, FUSE_AUIPC_LW,
+    src1 = s->pc + s->isa.imm; R(s->isa.rd) = src1;
+    s ++; s->dnpc = s->snpc; cpu.pc = s->pc;
+    R(s->isa.rd) = SEXT(Mr(src1 + s->isa.imm, 4), 32));
+  FUSION(fuse_slt_branch, FUSE_SLT_BRANCH,
+    // slt and sltu read $zero as rs2 after decoding, slti and sltiu read 0 as imm
+    src1 = R(s->isa.rs1); src2 = R(s->isa.rs2) + s->isa.imm;
+    bool unsign = BITS(s->isa.inst, 12, 12);
+    word_t t = unsign ? src1 < src2 : (sword_t)src1 < (sword_t)src2;
+    R(s->isa.rd) = t;
+    // bne has funct3 = 001, and beq has 000
+    s ++; s->dnpc = (t != 0) == BITS(s->isa.inst, 12, 12) ? s->pc + s->isa.imm : s->snpc);
+#endif
 }
 
 int isa_exec_once(Decode *s) {
-  s->isa.inst = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
+#ifdef CONFIG_DECODE_CACHE
+  DecodeCacheEntry *e = &dcache[dcache_index(s->pc)];
+  if (likely(e->pc == s->pc)) {
+    dcache_hit ++;
+    s->isa = e->isa;
+    // the instruction cache still sees the fetch
+    IFDEF(CONFIG_CACHESIM, vaddr_ifetch(s->pc, MUXDEF(CONFIG_RVC, s->isa.ilen, 4)));
+    s->snpc += MUXDEF(CONFIG_RVC, s->isa.ilen, 4);
+    return decode_exec(s, 1);
+  }
+
+  dcache_miss ++;
+  fetch_inst(s);
+  s->isa.handler = NULL;
+  decode_exec(s, 0);
+  // only instructions fetched from pmem are cached,
+  // since stores into them are observed by the memory system
+  bool cacheable = (isa_mmu_check(s->pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT) && in_pmem(s->pc);
+  if (cacheable) pmem_mark_code_page(s->pc, s->snpc - s->pc);
+  e->pc = cacheable ? s->pc : (vaddr_t)-1;
+  e->isa = s->isa;
+  return decode_exec(s, 1);
+#else
+  fetch_inst(s);
+  s->isa.handler = NULL;
+  return decode_exec(s, 1);
+#endif
+}
+
+#ifdef CONFIG_ENGINE_TB
+int isa_decode_once(Decode *s) {
+  fetch_inst(s);
+  s->isa.handler = NULL;
+  decode_exec(s, 0);
+  s->dnpc = s->snpc;
+  switch (BITS(s->isa.inst, 6, 0)) {
+    case 0b1100011: s->dnpc = s->pc + s->isa.imm; return TB_END_BRANCH;
+    case 0b1101111: s->dnpc = s->pc + s->isa.imm; return TB_END_JUMP;
+    case 0b1100111: return TB_END_INDIRECT;
+    case 0b0110111: case 0b0010111: case 0b0000011: case 0b0100011:
+    case 0b0010011: case 0b0110011: case 0b0001111: return TB_END_NONE;
+    default: return TB_END_STOP;
+  }
+}
+
+int isa_exec_block(Decode *s, int n) {
+  return decode_exec(s, n);
+}
+
+#ifdef CONFIG_FUSION
+static int fusion_kind(uint32_t a, uint32_t b) {
+  uint32_t op_a = BITS(a, 6, 0), op_b = BITS(b, 6, 0);
+  uint32_t f3_a = BITS(a, 14, 12), f3_b = BITS(b, 14, 12);
+  uint32_t rd_a = BITS(a, 11, 7), rd_b = BITS(b, 11, 7);
+  uint32_t rs1_b = BITS(b, 19, 15), rs2_b = BITS(b, 24, 20);
+  // the second instruction should read the result of the first one
+  if (rd_a == 0 || rs1_b != rd_a) return -1;
+  switch (op_a) {
+    case 0b0110111: // lui
+      if (op_b == 0b0010011 && f3_b == 0 && rd_b == rd_a) return FUSE_LI;
+      return -1;
+    case 0b0010111: // auipc
+      if (op_b == 0b1100111 && f3_b == 0) return FUSE_AUIPC_JALR;
+      if (op_b == 0b0000011 && f3_b == 2) return FUSE_AUIPC_LW;
+      return -1;
+    case 0b0110011: // slt, sltu
+      if (BITS(a, 31, 25) != 0) return -1;
+      // fall through
+    case 0b0010011: // slti, sltiu
+      if ((f3_a == 2 || f3_a == 3) && op_b == 0b1100011 && f3_b <= 1 && rs2_b == 0)
+        return FUSE_SLT_BRANCH;
+      return -1;
+    default: return -1;
+  }
+}
+
+// Fuse adjacent instruction pairs in the decoded block `s' of `n' instructions.
+// Entering the block at the second instruction of a pair is not possible,
+// since a block always starts with the instruction at its own pc.
+void isa_fuse_block(Decode *s, int n) {
+  assert(fusion_handler != NULL);
+  for (int i = 0; i + 1 < n; i ++) {
+    // the second instruction should be on the fall-through path
+    if (s[i + 1].pc != s[i].snpc) continue;
+    int kind = fusion_kind(s[i].isa.inst, s[i + 1].isa.inst);
+    if (kind < 0) continue;
+    s[i].isa.plain_handler = s[i].isa.handler;
+    s[i].isa.handler = fusion_handler[kind];
+    i ++;
+  }
+}
+
+void fusion_statistic() {
+  extern uint64_t g_nr_guest_inst;
+  uint64_t nr_fused = 0;
+  for (int i = 0; i < NR_FUSION; i ++) {
+    Log("fusion %-14s: hit = %" PRIu64, fusion_name[i], fusion_hit[i]);
+    nr_fused += fusion_hit[i];
+  }
+  // instructions run by compiled code are not dispatched at all
+  if (g_nr_guest_inst > 0 && !ISDEF(CONFIG_ENGINE_JIT)) {
+    Log("fusion: dispatches per instruction = %.4f",
+        (double)(g_nr_guest_inst - nr_fused) / g_nr_guest_inst);
+  }
 }
+#endif
+#endif
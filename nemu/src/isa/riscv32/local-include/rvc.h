@@ -0,0 +1,30 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV_RVC_H__
+#define __RISCV_RVC_H__
+
+#include <common.h>
+
+// The 32-bit equivalent of every 16-bit encoding, built by init_rvc().
+// Encodings ending with 0b11 are not compressed and map to 0, which is
+// also the expansion of illegal compressed instructions.
+extern uint32_t rvc_table[1 << 16];
+
+static inline bool rvc_is_compressed(uint32_t lo) {
+  return (lo & 0x3) != 0x3;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "local-include/rvc.h"
+
+uint32_t rvc_table[1 << 16] = {};
+
+// register fields of CIW, CL, CS, CA and CB formats
+#define RC(hi, lo) (BITS(c, hi, lo) + 8)
+
+static uint32_t enc_r(int f7, int rs2, int rs1, int f3, int rd, int op) {
+  return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+static uint32_t enc_i(word_t imm, int rs1, int f3, int rd, int op) {
+  return (BITS(imm, 11, 0) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+static uint32_t enc_s(word_t imm, int rs2, int rs1, int f3) {
+  return (BITS(imm, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (BITS(imm, 4, 0) << 7) | 0b0100011;
+}
+static uint32_t enc_b(word_t imm, int rs2, int rs1, int f3) {
+  return (BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | (rs2 << 20) | (rs1 << 15) |
+         (f3 << 12) | (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | 0b1100011;
+}
+static uint32_t enc_j(word_t imm, int rd) {
+  return (BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) |
+         (BITS(imm, 19, 12) << 12) | (rd << 7) | 0b1101111;
+}
+
+// offset of C.J and C.JAL
+static word_t imm_cj(uint32_t c) {
+  return SEXT((BITS(c, 12, 12) << 11) | (BITS(c, 8, 8) << 10) | (BITS(c, 10, 9) << 8) |
+              (BITS(c, 6, 6) << 7) | (BITS(c, 7, 7) << 6) | (BITS(c, 2, 2) << 5) |
+              (BITS(c, 11, 11) << 4) | (BITS(c, 5, 3) << 1), 12);
+}
+// offset of C.BEQZ and C.BNEZ
+static word_t imm_cb(uint32_t c) {
+  return SEXT((BITS(c, 12, 12) << 8) | (BITS(c, 6, 5) << 6) | (BITS(c, 2, 2) << 5) |
+              (BITS(c, 11, 10) << 3) | (BITS(c, 4, 3) << 1), 9);
+}
+// 6-bit immediate of CI format
+static word_t imm_ci(uint32_t c) {
+  return SEXT((BITS(c, 12, 12) << 5) | BITS(c, 6, 2), 6);
+}
+
+// Expand a compressed instruction of RV32C, return 0 if it is illegal
+// or not supported (floating-point loads and stores).
+static uint32_t rvc_expand(uint32_t c) {
+  int rd = BITS(c, 11, 7), rs2 = BITS(c, 6, 2);
+  switch ((BITS(c, 15, 13) << 2) | BITS(c, 1, 0)) {
+    // quadrant 0
+    case 0b00000: { // c.addi4spn
+      word_t imm = (BITS(c, 10, 7) << 6) | (BITS(c, 12, 11) << 4) | (BITS(c, 5, 5) << 3) | (BITS(c, 6, 6) << 2);
+      return imm == 0 ? 0 : enc_i(imm, 2, 0b000, RC(4, 2), 0b0010011);
+    }
+    case 0b01000: { // c.lw
+      word_t imm = (BITS(c, 5, 5) << 6) | (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2);
+      return enc_i(imm, RC(9, 7), 0b010, RC(4, 2), 0b0000011);
+    }
+    case 0b11000: { // c.sw
+      word_t imm = (BITS(c, 5, 5) << 6) | (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2);
+      return enc_s(imm, RC(4, 2), RC(9, 7), 0b010);
+    }
+
+    // quadrant 1
+    case 0b00001: return enc_i(imm_ci(c), rd, 0b000, rd, 0b0010011); // c.addi, c.nop
+    case 0b00101: return enc_j(imm_cj(c), 1);                        // c.jal
+    case 0b01001: return enc_i(imm_ci(c), 0, 0b000, rd, 0b0010011);  // c.li
+    case 0b01101:
+      if (rd == 2) { // c.addi16sp
+        word_t imm = SEXT((BITS(c, 12, 12) << 9) | (BITS(c, 4, 3) << 7) | (BITS(c, 5, 5) << 6) |
+                          (BITS(c, 2, 2) << 5) | (BITS(c, 6, 6) << 4), 10);
+        return imm == 0 ? 0 : enc_i(imm, 2, 0b000, 2, 0b0010011);
+      } else { // c.lui
+        word_t imm = imm_ci(c);
+        return imm == 0 ? 0 : (imm << 12) | (rd << 7) | 0b0110111;
+      }
+    case 0b10001: {
+      int rs1 = RC(9, 7);
+      switch (BITS(c, 11, 10)) {
+        case 0b00: // c.srli
+          return BITS(c, 12, 12) ? 0 : enc_r(0x00, BITS(c, 6, 2), rs1, 0b101, rs1, 0b0010011);
+        case 0b01: // c.srai
+          return BITS(c, 12, 12) ? 0 : enc_r(0x20, BITS(c, 6, 2), rs1, 0b101, rs1, 0b0010011);
+        case 0b10: return enc_i(imm_ci(c), rs1, 0b111, rs1, 0b0010011); // c.andi
+        default: {
+          if (BITS(c, 12, 12)) return 0; // c.subw and c.addw of RV64C
+          static const int f7[4] = { 0x20, 0x00, 0x00, 0x00 };
+          static const int f3[4] = { 0b000, 0b100, 0b110, 0b111 }; // c.sub, c.xor, c.or, c.and
+          int op = BITS(c, 6, 5);
+          return enc_r(f7[op], RC(4, 2), rs1, f3[op], rs1, 0b0110011);
+        }
+      }
+    }
+    case 0b10101: return enc_j(imm_cj(c), 0);                         // c.j
+    case 0b11001: return enc_b(imm_cb(c), 0, RC(9, 7), 0b000);        // c.beqz
+    case 0b11101: return enc_b(imm_cb(c), 0, RC(9, 7), 0b001);        // c.bnez
+
+    // quadrant 2
+    case 0b00010: // c.slli
+      return BITS(c, 12, 12) ? 0 : enc_r(0x00, BITS(c, 6, 2), rd, 0b001, rd, 0b0010011);
+    case 0b01010: { // c.lwsp
+      word_t imm = (BITS(c, 3, 2) << 6) | (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2);
+      return rd == 0 ? 0 : enc_i(imm, 2, 0b010, rd, 0b0000011);
+    }
+    case 0b10010:
+      if (BITS(c, 12, 12) == 0) {
+        if (rs2 == 0) return rd == 0 ? 0 : enc_i(0, rd, 0b000, 0, 0b1100111); // c.jr
+        return enc_r(0, rs2, 0, 0b000, rd, 0b0110011);                        // c.mv
+      }
+      if (rs2 == 0) {
+        if (rd == 0) return 0x00100073;                                      // c.ebreak
+        return enc_i(0, rd, 0b000, 1, 0b1100111);                            // c.jalr
+      }
+      return enc_r(0, rs2, rd, 0b000, rd, 0b0110011);                        // c.add
+    case 0b11010: { // c.swsp
+      word_t imm = (BITS(c, 8, 7) << 6) | (BITS(c, 12, 9) << 2);
+      return enc_s(imm, rs2, 2, 0b010);
+    }
+    default: return 0;
+  }
+}
+
+void init_rvc() {
+  for (uint32_t c = 0; c < (1 << 16); c ++) {
+    rvc_table[c] = rvc_is_compressed(c) ? rvc_expand(c) : 0;
+  }
+}
@@ -0,0 +1,79 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <device/intr.h>
+#include "../local-include/csr.h"
+
+// Return false if the CSR is not implemented, or written but read-only.
+bool csr_check(int addr, bool wen) {
+  switch (addr) {
+    case CSR_MVENDORID: case CSR_MARCHID: case CSR_MIMPID: case CSR_MHARTID:
+      return !wen;
+    case CSR_SATP: case CSR_MSTATUS: case CSR_MISA: case CSR_MIE: case CSR_MTVEC:
+    case CSR_MSCRATCH: case CSR_MEPC: case CSR_MCAUSE: case CSR_MTVAL: case CSR_MIP:
+      return true;
+    default: return false;
+  }
+}
+
+word_t csr_read(int addr) {
+  switch (addr) {
+    case CSR_SATP:     return cpu.csr.satp;
+    case CSR_MSTATUS:  return cpu.csr.mstatus;
+    case CSR_MIE:      return cpu.csr.mie;
+    case CSR_MTVEC:    return cpu.csr.mtvec;
+    case CSR_MSCRATCH: return cpu.csr.mscratch;
+    case CSR_MEPC:     return cpu.csr.mepc;
+    case CSR_MCAUSE:   return cpu.csr.mcause;
+    case CSR_MTVAL:    return cpu.csr.mtval;
+    case CSR_MIP:
+      // the pending bits come from devices, which REF does not have
+      difftest_skip_ref();
+      return intr_mip();
+    // the machine information is all zero, which may differ from REF
+    case CSR_MISA: case CSR_MVENDORID: case CSR_MARCHID: case CSR_MIMPID: case CSR_MHARTID:
+      difftest_skip_ref();
+      return 0;
+    default: panic("unsupported CSR 0x%03x at pc = " FMT_WORD, addr, cpu.pc);
+  }
+}
+
+void csr_write(int addr, word_t val) {
+  switch (addr) {
+    case CSR_SATP: {
+      bool mode_change = (cpu.csr.satp ^ val) >> 31;
+      cpu.csr.satp = val;
+      mmu_flush(mode_change);
+      break;
+    }
+    case CSR_MSTATUS:  cpu.csr.mstatus = val; break;
+    case CSR_MIE:      cpu.csr.mie = val; break;
+    case CSR_MTVEC:    cpu.csr.mtvec = val; break;
+    case CSR_MSCRATCH: cpu.csr.mscratch = val; break;
+    case CSR_MEPC:     cpu.csr.mepc = val; break;
+    case CSR_MCAUSE:   cpu.csr.mcause = val; break;
+    case CSR_MTVAL:    cpu.csr.mtval = val; break;
+    case CSR_MIP:      break; // the pending bits are only cleared by taking the interrupts
+    case CSR_MISA:     break; // the extensions can not be changed
+    default: panic("unsupported CSR 0x%03x at pc = " FMT_WORD, addr, cpu.pc);
+  }
+  // a pending interrupt may be enabled now
+  if (addr == CSR_MSTATUS || addr == CSR_MIE) {
+    IFDEF(CONFIG_DEVICE, if (dev_intr_pending()) cpu_post_deadline(0));
+  }
+}
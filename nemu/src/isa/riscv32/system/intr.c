@@ -14,15 +14,59 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/cpu.h>
+#include <device/intr.h>
+#include "../local-include/csr.h"
+
+#ifdef CONFIG_DEVICE
+// the bit in mip and mie of each interrupt request line
+static const int irq_code[NR_IRQ] = { [IRQ_TIMER] = 7, [IRQ_KEYBOARD] = 11 };
+// lines in the order of priority, external interrupts are taken first
+static const int irq_order[NR_IRQ] = { IRQ_KEYBOARD, IRQ_TIMER };
+#endif
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+  word_t mstatus = cpu.csr.mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE);
+  if (cpu.csr.mstatus & MSTATUS_MIE) mstatus |= MSTATUS_MPIE;
+  cpu.csr.mstatus = mstatus | MSTATUS_MPP;
+  cpu.csr.mepc = epc;
+  cpu.csr.mcause = NO;
+  return cpu.csr.mtvec & ~(word_t)0x3;
+}
+
+vaddr_t intr_mret() {
+  word_t mstatus = cpu.csr.mstatus & ~MSTATUS_MIE;
+  if (cpu.csr.mstatus & MSTATUS_MPIE) mstatus |= MSTATUS_MIE;
+  cpu.csr.mstatus = mstatus | MSTATUS_MPIE;
+  // a pending interrupt may be taken now
+  IFDEF(CONFIG_DEVICE, if (dev_intr_pending()) cpu_post_deadline(0));
+  return cpu.csr.mepc;
+}
 
-  return 0;
+word_t intr_mip() {
+  word_t mip = 0;
+#ifdef CONFIG_DEVICE
+  uint32_t pending = dev_intr_pending();
+  for (int i = 0; i < NR_IRQ; i ++) {
+    if (pending & (1u << i)) mip |= (word_t)1 << irq_code[i];
+  }
+#endif
+  return mip;
 }
 
+// Called by the main loop only when some request line is raised.
+// The interrupt is acknowledged to the device when it is taken.
 word_t isa_query_intr() {
+#ifdef CONFIG_DEVICE
+  if (!(cpu.csr.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  uint32_t pending = dev_intr_pending();
+  for (int i = 0; i < NR_IRQ; i ++) {
+    int irq = irq_order[i];
+    if ((pending & (1u << irq)) && (cpu.csr.mie & ((word_t)1 << irq_code[irq]))) {
+      dev_ack_intr(irq);
+      return MCAUSE_INTR | irq_code[irq];
+    }
+  }
+#endif
   return INTR_EMPTY;
 }
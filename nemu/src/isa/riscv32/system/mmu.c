@@ -16,7 +16,69 @@
 #include <isa.h>
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include <cpu/tb.h>
+#include "../local-include/csr.h"
 
+#define PTE_V 0x01
+#define PTE_R 0x02
+#define PTE_W 0x04
+#define PTE_X 0x08
+#define PTE_A 0x40
+#define PTE_D 0x80
+
+#define VPN_BITS 10
+#define PTE_PPN(pte) ((paddr_t)((pte) >> 10) << PAGE_SHIFT)
+
+// Walk the Sv32 page table. Return the base of the physical page with
+// MEM_RET_OK in the page offset, or MEM_RET_FAIL on a page fault.
+// The accessed bit, and the dirty bit for stores, are set in the leaf PTE.
+// Stores always walk the table once after a TLB flush, since they have
+// their own TLB, so the dirty bit is set even if the page was read before.
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+  static const uint32_t perm[] = {
+    [MEM_TYPE_IFETCH] = PTE_X, [MEM_TYPE_READ] = PTE_R, [MEM_TYPE_WRITE] = PTE_W,
+  };
+  paddr_t base = (paddr_t)BITS(cpu.csr.satp, 21, 0) << PAGE_SHIFT;
+  for (int level = 1; level >= 0; level --) {
+    uint32_t vpn = BITS(vaddr, PAGE_SHIFT + VPN_BITS * (level + 1) - 1, PAGE_SHIFT + VPN_BITS * level);
+    paddr_t pte_addr = base + vpn * 4;
+    uint32_t pte = paddr_read(pte_addr, 4);
+    if (!(pte & PTE_V) || ((pte & (PTE_R | PTE_W)) == PTE_W)) return MEM_RET_FAIL;
+    if (pte & (PTE_R | PTE_X)) {
+      // a leaf PTE
+      if (!(pte & perm[type])) return MEM_RET_FAIL;
+      paddr_t ppage = PTE_PPN(pte);
+      if (level == 1) {
+        // a 4 MiB megapage should be aligned
+        if (BITS(pte, 19, 10) != 0) return MEM_RET_FAIL;
+        ppage |= vaddr & (BITMASK(VPN_BITS) << PAGE_SHIFT);
+      }
+      uint32_t ad = PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+      if ((pte & ad) != ad) paddr_write(pte_addr, 4, pte | ad);
+      return ppage | MEM_RET_OK;
+    }
+    base = PTE_PPN(pte);
+  }
   return MEM_RET_FAIL;
 }
+
+word_t isa_page_fault(vaddr_t vaddr, int type) {
+  static const word_t cause[] = {
+    [MEM_TYPE_IFETCH] = EXC_INST_PAGE_FAULT, [MEM_TYPE_READ] = EXC_LOAD_PAGE_FAULT,
+    [MEM_TYPE_WRITE] = EXC_STORE_PAGE_FAULT,
+  };
+  cpu.csr.mtval = vaddr;
+  return cause[type];
+}
+
+// Called when satp is written or sfence.vma is executed. Decoded instructions
+// are only cached for untranslated fetches, so they are dropped when
+// translation is turned on or off.
+void mmu_flush(bool mode_change) {
+  tlb_flush();
+  if (mode_change) {
+    void init_decode_cache();
+    IFDEF(CONFIG_DECODE_CACHE, init_decode_cache());
+    IFDEF(CONFIG_ENGINE_TB, tb_flush());
+  }
+}
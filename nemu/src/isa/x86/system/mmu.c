@@ -20,3 +20,7 @@
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
+
+word_t isa_page_fault(vaddr_t vaddr, int type) {
+  panic("page fault at vaddr = " FMT_WORD " is not supported", vaddr);
+}
@@ -0,0 +1,256 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/cache.h>
+
+#ifdef CONFIG_CACHESIM
+
+#define LINE_SHIFT __builtin_ctz(CONFIG_CACHE_LINE_SIZE)
+static_assert((CONFIG_CACHE_LINE_SIZE & (CONFIG_CACHE_LINE_SIZE - 1)) == 0,
+    "cache line size should be a power of 2");
+
+// Caches hold line numbers, which are physical addresses shifted right by
+// LINE_SHIFT. The L2 cache is neither inclusive nor exclusive, and stores
+// are not observed by the L1 instruction cache.
+#define LINE_INVALID UINT64_MAX
+
+typedef struct {
+  uint64_t line;
+  uint64_t stamp; // time of the last access for LRU
+  bool dirty;
+} Line;
+
+enum { L1I, L1D, L2, NR_CACHE };
+static const char *cache_name[NR_CACHE] = { "L1I", "L1D", "L2" };
+
+typedef struct Cache {
+  int id;
+  int nr_set, nr_way;
+  Line *lines;        // `nr_way' lines for each set
+  uint64_t *plru;     // a tree of `nr_way - 1' bits for each set
+  struct Cache *next; // NULL for memory
+  uint64_t clock;
+  uint64_t access[3], miss[3], writeback; // indexed by MEM_TYPE_*
+} Cache;
+
+static Cache caches[NR_CACHE];
+
+// misses caused by each pc, in an open-addressing hash table
+typedef struct {
+  vaddr_t pc;
+  bool valid;
+  uint64_t miss[NR_CACHE];
+} PCMiss;
+
+bool cache_bypass = false;
+
+static PCMiss *pc_miss = NULL;
+static uint32_t pc_cap = 0, nr_pc = 0;
+
+static inline uint32_t pc_hash(vaddr_t pc) {
+  return (uint64_t)pc * 0x9e3779b97f4a7c15ull >> 32;
+}
+
+static PCMiss* pc_miss_slot(PCMiss *table, uint32_t cap, vaddr_t pc) {
+  uint32_t i = pc_hash(pc) & (cap - 1);
+  while (table[i].valid && table[i].pc != pc) i = (i + 1) & (cap - 1);
+  return &table[i];
+}
+
+static void pc_miss_count(int id) {
+  if (nr_pc * 2 >= pc_cap) {
+    uint32_t cap = pc_cap * 2;
+    PCMiss *table = calloc(cap, sizeof(PCMiss));
+    assert(table);
+    for (uint32_t i = 0; i < pc_cap; i ++) {
+      if (pc_miss[i].valid) *pc_miss_slot(table, cap, pc_miss[i].pc) = pc_miss[i];
+    }
+    free(pc_miss);
+    pc_miss = table;
+    pc_cap = cap;
+  }
+  PCMiss *e = pc_miss_slot(pc_miss, pc_cap, cpu.pc);
+  if (!e->valid) { e->valid = true; e->pc = cpu.pc; nr_pc ++; }
+  e->miss[id] ++;
+}
+
+// The tree pseudo-LRU has one bit for each inner node. Node 1 is the root,
+// and the children of node i are 2i and 2i+1. A bit points to the half to
+// replace next, 0 for the left one.
+static void touch(Cache *c, int set, int way) {
+  Line *l = &c->lines[set * c->nr_way + way];
+  l->stamp = ++ c->clock;
+  if (ISDEF(CONFIG_CACHE_REPL_PLRU)) {
+    uint64_t *bits = &c->plru[set];
+    int node = 1;
+    for (int half = c->nr_way / 2; half > 0; half /= 2) {
+      int right = (way & half) != 0;
+      // point away from the accessed half
+      if (right) *bits &= ~(1ull << node);
+      else *bits |= 1ull << node;
+      node = node * 2 + right;
+    }
+  }
+}
+
+static int victim(Cache *c, int set) {
+  Line *l = &c->lines[set * c->nr_way];
+  for (int w = 0; w < c->nr_way; w ++) {
+    if (l[w].line == LINE_INVALID) return w;
+  }
+#if defined(CONFIG_CACHE_REPL_LRU)
+  int way = 0;
+  for (int w = 1; w < c->nr_way; w ++) {
+    if (l[w].stamp < l[way].stamp) way = w;
+  }
+  return way;
+#elif defined(CONFIG_CACHE_REPL_PLRU)
+  int node = 1, way = 0;
+  for (int half = c->nr_way / 2; half > 0; half /= 2) {
+    int right = (c->plru[set] >> node) & 1;
+    if (right) way |= half;
+    node = node * 2 + right;
+  }
+  return way;
+#else
+  return rand() % c->nr_way;
+#endif
+}
+
+// Access `line' in `c', and pass misses and write-backs to the next level.
+static void cache_ref(Cache *c, uint64_t line, int type) {
+  bool is_write = (type == MEM_TYPE_WRITE);
+  int set = line % c->nr_set;
+  Line *l = &c->lines[set * c->nr_way];
+  c->access[type] ++;
+
+  for (int w = 0; w < c->nr_way; w ++) {
+    if (l[w].line != line) continue;
+    touch(c, set, w);
+    if (is_write) {
+      if (ISDEF(CONFIG_CACHE_WRITE_BACK)) l[w].dirty = true;
+      else if (c->next != NULL) cache_ref(c->next, line, MEM_TYPE_WRITE);
+    }
+    return;
+  }
+
+  c->miss[type] ++;
+  pc_miss_count(c->id);
+  if (is_write && ISDEF(CONFIG_CACHE_WRITE_THROUGH)) {
+    if (c->next != NULL) cache_ref(c->next, line, MEM_TYPE_WRITE);
+    return;
+  }
+  int w = victim(c, set);
+  if (l[w].line != LINE_INVALID && l[w].dirty) {
+    c->writeback ++;
+    if (c->next != NULL) cache_ref(c->next, l[w].line, MEM_TYPE_WRITE);
+  }
+  // a store miss reads the line before writing it
+  if (c->next != NULL) cache_ref(c->next, line, is_write ? MEM_TYPE_READ : type);
+  l[w].line = line;
+  l[w].dirty = is_write;
+  touch(c, set, w);
+}
+
+static inline bool cacheable(paddr_t addr) {
+  if (likely(in_pmem(addr))) return true;
+  return MUXDEF(CONFIG_MEM_REGIONS_ENABLE, mem_region(addr) != NULL, false);
+}
+
+void cache_access(paddr_t addr, int len, int type) {
+  if (cache_bypass || !cacheable(addr)) return;
+  Cache *c = &caches[type == MEM_TYPE_IFETCH ? L1I : L1D];
+  uint64_t last = ((uint64_t)addr + len - 1) >> LINE_SHIFT;
+  for (uint64_t line = addr >> LINE_SHIFT; line <= last; line ++) cache_ref(c, line, type);
+}
+
+static void init_one(int id, int size_kb, int nr_way, Cache *next) {
+  Cache *c = &caches[id];
+  int nr_line = size_kb * 1024 / CONFIG_CACHE_LINE_SIZE;
+  Assert(nr_way > 0 && nr_line >= nr_way && nr_line % nr_way == 0,
+      "%s cache: %d KB can not be divided into %d ways", cache_name[id], size_kb, nr_way);
+  if (ISDEF(CONFIG_CACHE_REPL_PLRU)) {
+    Assert((nr_way & (nr_way - 1)) == 0 && nr_way <= 64,
+        "%s cache: pseudo-LRU needs a power of 2 ways up to 64", cache_name[id]);
+  }
+  c->id = id;
+  c->nr_way = nr_way;
+  c->nr_set = nr_line / nr_way;
+  c->next = next;
+  c->lines = malloc(sizeof(Line) * nr_line);
+  c->plru = calloc(c->nr_set, sizeof(uint64_t));
+  assert(c->lines && c->plru);
+  for (int i = 0; i < nr_line; i ++) c->lines[i] = (Line) { .line = LINE_INVALID };
+}
+
+void init_cache() {
+  init_one(L2, CONFIG_L2_SIZE, CONFIG_L2_WAYS, NULL);
+  init_one(L1I, CONFIG_L1I_SIZE, CONFIG_L1I_WAYS, &caches[L2]);
+  init_one(L1D, CONFIG_L1D_SIZE, CONFIG_L1D_WAYS, &caches[L2]);
+  pc_cap = 1024;
+  pc_miss = calloc(pc_cap, sizeof(PCMiss));
+  assert(pc_miss);
+  Log("cache simulation: L1I %d KB %d-way, L1D %d KB %d-way, L2 %d KB %d-way, %d-byte lines, %s, %s",
+      CONFIG_L1I_SIZE, CONFIG_L1I_WAYS, CONFIG_L1D_SIZE, CONFIG_L1D_WAYS,
+      CONFIG_L2_SIZE, CONFIG_L2_WAYS, CONFIG_CACHE_LINE_SIZE,
+      MUXDEF(CONFIG_CACHE_REPL_LRU, "LRU", MUXDEF(CONFIG_CACHE_REPL_PLRU, "pseudo-LRU", "random")),
+      MUXDEF(CONFIG_CACHE_WRITE_BACK, "write-back", "write-through"));
+}
+
+static uint64_t pc_miss_total(const PCMiss *e) {
+  return e->miss[L1I] + e->miss[L1D] + e->miss[L2];
+}
+
+static int cmp_pc_miss(const void *a, const void *b) {
+  uint64_t x = pc_miss_total(a), y = pc_miss_total(b);
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void cache_statistic() {
+  static const char *type_name[3] = { "fetch", "load", "store" };
+  for (int id = 0; id < NR_CACHE; id ++) {
+    Cache *c = &caches[id];
+    for (int t = 0; t < 3; t ++) {
+      if (c->access[t] == 0) continue;
+      Log("%-3s %-5s: access = %" PRIu64 ", miss = %" PRIu64 ", miss rate = %.2f%%",
+          cache_name[id], type_name[t], c->access[t], c->miss[t], c->miss[t] * 100.0 / c->access[t]);
+    }
+    if (c->writeback != 0) Log("%-3s write-backs = %" PRIu64, cache_name[id], c->writeback);
+  }
+
+  if (nr_pc == 0) return;
+  PCMiss *e = malloc(sizeof(PCMiss) * nr_pc);
+  assert(e);
+  int n = 0;
+  for (uint32_t i = 0; i < pc_cap; i ++) {
+    if (pc_miss[i].valid) e[n ++] = pc_miss[i];
+  }
+  qsort(e, n, sizeof(PCMiss), cmp_pc_miss);
+  if (n > CONFIG_CACHE_REPORT_PC) n = CONFIG_CACHE_REPORT_PC;
+  Log("pcs with the most misses:");
+  Log("%-10s %10s %10s %10s  %s", "pc", "L1I", "L1D", "L2", "symbol");
+  for (int i = 0; i < n; i ++) {
+    vaddr_t offset = 0;
+    const char *name = elf_symbol_name(e[i].pc, &offset);
+    char sym[128] = "";
+    if (name != NULL) snprintf(sym, sizeof(sym), "%s+0x%" PRIx64, name, (uint64_t)offset);
+    Log(FMT_WORD " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "  %s",
+        e[i].pc, e[i].miss[L1I], e[i].miss[L1D], e[i].miss[L2], sym);
+  }
+  free(e);
+}
+#endif
@@ -13,12 +13,17 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#define _GNU_SOURCE // memfd_create()
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/cache.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <unistd.h>
+#include <errno.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
@@ -27,6 +32,82 @@ static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
+// Host memory of guest physical pages, indexed by the page number, for loads
+// and stores respectively. An entry is the host address minus the guest address
+// of the page, or 0 if accesses should go through the slow path, e.g. device
+// registers with side effects, and code pages for stores. Only the low 4 GiB
+// of the physical address space is covered.
+#define NR_PAGE_HOST (1ull << (32 - PAGE_SHIFT))
+static uintptr_t page_host[2][NR_PAGE_HOST] = {};
+
+static inline uintptr_t page_addend(paddr_t addr, bool is_write) {
+#ifdef PMEM64
+  if (addr >> 32) return 0;
+#endif
+  return page_host[is_write][addr >> PAGE_SHIFT];
+}
+
+void paddr_map_host(paddr_t addr, uint64_t len, uint8_t *host, bool writable) {
+  // only pages covered entirely are mapped
+  uint64_t first = ((uint64_t)addr + PAGE_MASK) >> PAGE_SHIFT;
+  uint64_t last = ((uint64_t)addr + len) >> PAGE_SHIFT;
+  for (uint64_t pn = first; pn < last && pn < NR_PAGE_HOST; pn ++) {
+    uintptr_t addend = (uintptr_t)host - addr;
+    page_host[0][pn] = addend;
+    page_host[1][pn] = (writable ? addend : 0);
+  }
+}
+
+uint8_t* paddr_host(paddr_t addr, bool is_write) {
+  uintptr_t addend = page_addend(addr, is_write);
+  return addend == 0 ? NULL : (uint8_t *)(addr + addend);
+}
+
+#ifdef CONFIG_PMEM_CODE_PAGE
+uint8_t pmem_code_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+
+static void mark_code_page(paddr_t paddr) {
+  uint8_t *p = &pmem_code_page[(paddr - CONFIG_MBASE) >> PAGE_SHIFT];
+  if (likely(*p)) return;
+  *p = 1;
+  // stores into the page should not bypass check_code_write() from now on,
+  // including the ones crossing into it from the previous page
+  uint64_t pn = paddr >> PAGE_SHIFT;
+  if (pn < NR_PAGE_HOST) page_host[1][pn] = 0;
+  if (pn > 0 && pn - 1 < NR_PAGE_HOST) page_host[1][pn - 1] = 0;
+  tlb_flush();
+}
+
+void pmem_mark_code_page(paddr_t paddr, int len) {
+  mark_code_page(paddr);
+  // an instruction may cross into the next page with the C extension
+  paddr_t last = paddr + len - 1;
+  if ((last >> PAGE_SHIFT) != (paddr >> PAGE_SHIFT)) mark_code_page(last);
+}
+
+static void check_code_write(paddr_t addr, int len) {
+  void decode_cache_invalidate(paddr_t paddr, int len);
+  void tb_invalidate(paddr_t paddr, int len);
+  void aot_invalidate_code(paddr_t paddr, int len);
+  if (unlikely(pmem_code_page[(addr - CONFIG_MBASE) >> PAGE_SHIFT] ||
+        pmem_code_page[(addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT])) {
+    IFDEF(CONFIG_DECODE_CACHE, decode_cache_invalidate(addr, len));
+    IFDEF(CONFIG_ENGINE_TB, tb_invalidate(addr, len));
+    IFDEF(CONFIG_AOT, aot_invalidate_code(addr, len));
+  }
+}
+#endif
+
+void pmem_check_code_write(paddr_t addr, uint64_t len) {
+#ifdef CONFIG_PMEM_CODE_PAGE
+  // one page at a time, since check_code_write() only looks at both ends
+  for (uint64_t p = addr, end = (uint64_t)addr + len; p < end; p = (p | PAGE_MASK) + 1) {
+    uint64_t next = (p | PAGE_MASK) + 1;
+    check_code_write(p, (next < end ? next : end) - p);
+  }
+#endif
+}
+
 static word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
   return ret;
@@ -34,6 +115,205 @@ static word_t pmem_read(paddr_t addr, int len) {
 
 static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
+  IFDEF(CONFIG_PMEM_CODE_PAGE, check_code_write(addr, len));
+}
+
+#ifdef CONFIG_PMEM_MMAP
+#include <sys/mman.h>
+#include <signal.h>
+
+#define HUGE_PAGE_SIZE (2ul * 1024 * 1024)
+
+#ifdef CONFIG_MEM_RANDOM
+// pmem is filled with random values lazily, one chunk at a time when it is
+// touched for the first time, so that startup does not depend on CONFIG_MSIZE.
+// Chunks not filled yet are inaccessible, and the SIGSEGV handler fills them.
+#define PMEM_PROT PROT_NONE
+#define CHUNK_SIZE HUGE_PAGE_SIZE
+#define NR_CHUNK ((CONFIG_MSIZE + CHUNK_SIZE - 1) / CHUNK_SIZE)
+
+static uint8_t chunk_filled[NR_CHUNK] = {};
+static uint64_t fill_seed = 0;
+static struct sigaction old_segv_action;
+
+static void fill_chunk(size_t idx) {
+  uint8_t *chunk = pmem + idx * CHUNK_SIZE;
+  size_t len = CONFIG_MSIZE - idx * CHUNK_SIZE;
+  if (len > CHUNK_SIZE) len = CHUNK_SIZE;
+  int ret = mprotect(chunk, len, PROT_READ | PROT_WRITE);
+  assert(ret == 0);
+  // xorshift64, seeded by the chunk index so that the order of touches does not matter
+  uint64_t x = (fill_seed ^ ((idx + 1) * 0x9e3779b97f4a7c15ull)) | 1;
+  uint64_t *p = (uint64_t *)chunk;
+  for (size_t i = 0; i < len / sizeof(*p); i ++) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    p[i] = x;
+  }
+  chunk_filled[idx] = 1;
+}
+
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  if (addr >= pmem && addr < pmem + CONFIG_MSIZE) {
+    size_t idx = (addr - pmem) / CHUNK_SIZE;
+    if (!chunk_filled[idx]) { fill_chunk(idx); return; }
+  }
+  // not for pmem, chain to the previous handler, e.g. the one of another
+  // NEMU instance loaded for DiffTest, or let the retried access crash
+  if (old_segv_action.sa_flags & SA_SIGINFO) old_segv_action.sa_sigaction(sig, info, ucontext);
+  else sigaction(SIGSEGV, &old_segv_action, NULL);
+}
+
+static void init_lazy_fill() {
+  fill_seed = ((uint64_t)rand() << 32) | rand();
+  struct sigaction s = {};
+  s.sa_sigaction = pmem_fault_handler;
+  s.sa_flags = SA_SIGINFO;
+  int ret = sigaction(SIGSEGV, &s, &old_segv_action);
+  Assert(ret == 0, "Can not set SIGSEGV handler");
+}
+
+void pmem_populate(paddr_t addr, uint64_t len) {
+  if (len == 0) return;
+  for (size_t i = (addr - CONFIG_MBASE) / CHUNK_SIZE; i <= (addr + len - 1 - CONFIG_MBASE) / CHUNK_SIZE; i ++) {
+    if (i < NR_CHUNK && !chunk_filled[i]) fill_chunk(i);
+  }
+}
+
+// Chunks covered by a file mapped at [addr, addr + len) should never be
+// filled, but the ones covered partly must be filled before mapping.
+static void mark_file_map(paddr_t addr, uint64_t len) {
+  for (size_t i = (addr - CONFIG_MBASE) / CHUNK_SIZE; i <= (addr + len - 1 - CONFIG_MBASE) / CHUNK_SIZE; i ++) {
+    chunk_filled[i] = 1;
+  }
+}
+#else
+#define PMEM_PROT (PROT_READ | PROT_WRITE)
+void pmem_populate(paddr_t addr, uint64_t len) {}
+static void mark_file_map(paddr_t addr, uint64_t len) {}
+#endif
+
+#ifdef CONFIG_PMEM_SHARE
+#include <fcntl.h>
+#include <pmem-share.h>
+
+static PmemShareHeader *share_hdr = NULL;
+
+static void init_share_header(int fd, uint64_t pmem_offset) {
+  share_hdr = mmap(NULL, sizeof(PmemShareHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(share_hdr != MAP_FAILED, "Can not map the header of %s: %s", CONFIG_PMEM_SHARE_FILE, strerror(errno));
+  static_assert(sizeof(CPU_state) <= sizeof(share_hdr->cpu), "CPU_state does not fit in PmemShareHeader");
+  share_hdr->version = PMEM_SHARE_VERSION;
+  share_hdr->cpu_size = sizeof(CPU_state);
+  share_hdr->pmem_offset = pmem_offset;
+  share_hdr->pmem_base = CONFIG_MBASE;
+  share_hdr->pmem_size = CONFIG_MSIZE;
+  strncpy(share_hdr->isa, str(__GUEST_ISA__), sizeof(share_hdr->isa) - 1);
+  // readers should check the magic number before the other fields
+  __atomic_store_n(&share_hdr->magic, PMEM_SHARE_MAGIC, __ATOMIC_RELEASE);
+}
+
+void pmem_share_update() {
+  extern uint64_t g_nr_guest_inst;
+  PmemShareHeader *h = share_hdr;
+  if (h == NULL) return;
+  uint64_t seq = h->seq;
+  __atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  h->nr_guest_inst = g_nr_guest_inst;
+  h->state = nemu_state.state;
+  h->halt_ret = nemu_state.halt_ret;
+  h->pc = cpu.pc;
+  memcpy(h->cpu, &cpu, sizeof(cpu));
+  __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+#endif
+
+static uint8_t* map_pmem(unsigned int mfd_flags, int mmap_flags) {
+#ifdef CONFIG_PMEM_SHARE
+  // pmem starts at a huge page boundary of the file after the header,
+  // so that tmpfs can still back it with huge pages
+  uint64_t off = HUGE_PAGE_SIZE;
+  int fd = open(CONFIG_PMEM_SHARE_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#else
+  uint64_t off = 0;
+  int fd = memfd_create("nemu-pmem", MFD_CLOEXEC | mfd_flags);
+#endif
+  if (fd < 0) return NULL;
+  uint8_t *p = NULL;
+  if (ftruncate(fd, off + CONFIG_MSIZE) == 0) {
+    // reserve one more huge page to align pmem
+    uint8_t *area = mmap(NULL, CONFIG_MSIZE + HUGE_PAGE_SIZE, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area != MAP_FAILED) {
+      p = mmap((void *)ROUNDUP(area, HUGE_PAGE_SIZE), CONFIG_MSIZE, PMEM_PROT,
+          MAP_SHARED | MAP_FIXED | mmap_flags, fd, off);
+      if (p == MAP_FAILED) {
+        munmap(area, CONFIG_MSIZE + HUGE_PAGE_SIZE);
+        p = NULL;
+      }
+    }
+  }
+  IFDEF(CONFIG_PMEM_SHARE, if (p != NULL) init_share_header(fd, off));
+  close(fd);
+  return p;
+}
+
+static void init_pmem_mmap() {
+#ifdef CONFIG_PMEM_HUGEPAGE_HUGETLB
+  // without MAP_NORESERVE, mmap() fails instead of raising SIGBUS later
+  // if there are not enough huge pages
+  pmem = map_pmem(MFD_HUGETLB, 0);
+  if (pmem == NULL) Log("Can not allocate huge pages for pmem: %s", strerror(errno));
+#endif
+  if (pmem == NULL) pmem = map_pmem(0, MAP_NORESERVE);
+  Assert(pmem, "Can not map pmem" MUXDEF(CONFIG_PMEM_SHARE, " to " CONFIG_PMEM_SHARE_FILE, "") ": %s",
+      strerror(errno));
+#ifdef CONFIG_PMEM_HUGEPAGE_THP
+  if (madvise(pmem, CONFIG_MSIZE, MADV_HUGEPAGE) != 0) {
+    Log("Can not use transparent huge pages for pmem: %s", strerror(errno));
+  }
+#endif
+  IFDEF(CONFIG_MEM_RANDOM, init_lazy_fill());
+}
+#else
+void pmem_populate(paddr_t addr, uint64_t len) {}
+#endif
+
+static void read_file(int fd, uint64_t off, uint8_t *buf, uint64_t len) {
+  while (len > 0) {
+    ssize_t ret = pread(fd, buf, len, off);
+    Assert(ret > 0, "Can not read the file at offset %" PRIu64 ": %s", off, ret < 0 ? strerror(errno) : "EOF");
+    buf += ret; off += ret; len -= ret;
+  }
+}
+
+void pmem_load_file(paddr_t addr, int fd, uint64_t off, uint64_t len) {
+  if (len == 0) return;
+  Assert(in_pmem(addr) && in_pmem(addr + len - 1), "[" FMT_PADDR ", " FMT_PADDR ") is out of bound of pmem",
+      addr, (paddr_t)(addr + len));
+  uint8_t *host = guest_to_host(addr);
+  // [head, tail) of the file is mapped copy-on-write, and the rest is read
+  uint64_t head = len, tail = len;
+#ifdef CONFIG_PMEM_MMAP
+  uint64_t h = ROUNDUP(host, PAGE_SIZE) - (uintptr_t)host;
+  // a private mapping would hide the image from readers of the shared file
+  if (ISNDEF(CONFIG_PMEM_SHARE) &&
+      ((off + h) & PAGE_MASK) == 0 && len > h && ROUNDDOWN(len - h, PAGE_SIZE) > 0) {
+    uint64_t n = ROUNDDOWN(len - h, PAGE_SIZE);
+    pmem_populate(addr + h, 1);
+    pmem_populate(addr + h + n - 1, 1);
+    // this fails on huge pages, then the file is read instead
+    if (mmap(host + h, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off + h) != MAP_FAILED) {
+      mark_file_map(addr + h, n);
+      head = h; tail = h + n;
+    }
+  }
+#endif
+  pmem_populate(addr, head);
+  read_file(fd, off, host, head);
+  pmem_populate(addr + tail, len - tail);
+  read_file(fd, off + tail, host + tail, len - tail);
 }
 
 static void out_of_bound(paddr_t addr) {
@@ -41,24 +321,62 @@ static void out_of_bound(paddr_t addr) {
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
+void init_mem_regions();
+
 void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  init_pmem_mmap();
 #endif
+#ifndef CONFIG_PMEM_MMAP
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+#endif
+  paddr_map_host(CONFIG_MBASE, CONFIG_MSIZE, pmem, true);
+#ifdef CONFIG_MEM_REGIONS_ENABLE
+  init_mem_regions();
+#endif
+  tlb_flush();
+  IFDEF(CONFIG_CACHESIM, init_cache());
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
 word_t paddr_read(paddr_t addr, int len) {
-  if (likely(in_pmem(addr))) return pmem_read(addr, len);
+  uintptr_t addend = page_addend(addr, false);
+  // reads crossing into the next page take the slow path, since the next
+  // page may be the end of pmem or an MMIO page with a callback
+  if (likely(addend != 0 && (addr & PAGE_MASK) <= PAGE_SIZE - len)) {
+    return host_read((void *)(addr + addend), len);
+  }
+  if (likely(in_pmem(addr) && in_pmem(addr + len - 1))) return pmem_read(addr, len);
+#ifdef CONFIG_MEM_REGIONS_ENABLE
+  MemRegion *r = mem_region(addr);
+  if (r != NULL) return host_read(r->host + (addr - r->base), len);
+#endif
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  uintptr_t addend = page_addend(addr, true);
+  // stores crossing into the next page take the slow path, since the next
+  // page may not allow direct stores, e.g. vmem pages not dirty yet
+  if (likely(addend != 0 && (addr & PAGE_MASK) <= PAGE_SIZE - len)) {
+    host_write((void *)(addr + addend), len, data);
+    return;
+  }
+  if (likely(in_pmem(addr) && in_pmem(addr + len - 1))) { pmem_write(addr, len, data); return; }
+#ifdef CONFIG_MEM_REGIONS_ENABLE
+  MemRegion *r = mem_region(addr);
+  if (r != NULL) {
+    Assert(!r->readonly, "address = " FMT_PADDR " is in read-only memory region '%s' at pc = " FMT_WORD,
+        addr, r->name, cpu.pc);
+    host_write(r->host + (addr - r->base), len, data);
+    return;
+  }
+#endif
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
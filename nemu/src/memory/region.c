@@ -0,0 +1,104 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef CONFIG_MEM_REGIONS_ENABLE
+
+static MemRegion *regions = NULL;
+static int nr_region = 0;
+
+static uint8_t* map_region(MemRegion *r, const char *file) {
+  // holes are never backed by host memory, and untouched pages are not either
+  uint8_t *host = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(host != MAP_FAILED, "Can not map memory region '%s': %s", r->name, strerror(errno));
+  if (file != NULL) {
+    int fd = open(file, O_RDONLY);
+    Assert(fd >= 0, "Can not open '%s' for memory region '%s'", file, r->name);
+    struct stat st;
+    int ret = fstat(fd, &st);
+    assert(ret == 0);
+    // guest stores are private, the rest of the region after the file is zero
+    uint64_t len = ROUNDUP(st.st_size, PAGE_SIZE);
+    if (len > r->size) len = r->size;
+    if (len > 0) {
+      void *p = mmap(host, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+      Assert(p != MAP_FAILED, "Can not map '%s': %s", file, strerror(errno));
+    }
+    close(fd);
+  }
+  if (r->readonly) mprotect(host, r->size, PROT_READ);
+  return host;
+}
+
+// Parse one region in the form of name:base:size[:ro|rw[:file]].
+static void add_region(char *spec) {
+  char *save = NULL;
+  char *name = strtok_r(spec, ":", &save);
+  char *base = strtok_r(NULL, ":", &save);
+  char *size = strtok_r(NULL, ":", &save);
+  char *flags = strtok_r(NULL, ":", &save);
+  char *file = strtok_r(NULL, "", &save);
+  Assert(name && base && size, "Invalid memory region '%s', expect name:base:size[:ro|rw[:file]]",
+      name ? name : "");
+  Assert(flags == NULL || strcmp(flags, "ro") == 0 || strcmp(flags, "rw") == 0,
+      "Invalid flags '%s' of memory region '%s'", flags, name);
+
+  uint64_t b = strtoull(base, NULL, 0), sz = strtoull(size, NULL, 0);
+  Assert(sz > 0 && (b & PAGE_MASK) == 0 && (sz & PAGE_MASK) == 0,
+      "Memory region '%s' should be page aligned", name);
+  Assert((paddr_t)(b + sz - 1) == b + sz - 1 && b + sz - 1 >= b,
+      "Memory region '%s' is out of the physical address space", name);
+  MemRegion r = { .name = strdup(name), .base = b, .size = sz,
+    .readonly = (flags && strcmp(flags, "ro") == 0) };
+  paddr_t left = r.base, right = r.base + r.size - 1;
+  Assert(!(left <= PMEM_RIGHT && right >= PMEM_LEFT), "Memory region '%s' is overlapped with pmem", name);
+  for (int i = 0; i < nr_region; i ++) {
+    Assert(!(left <= regions[i].base + regions[i].size - 1 && right >= regions[i].base),
+        "Memory region '%s' is overlapped with '%s'", name, regions[i].name);
+  }
+
+  r.host = map_region(&r, file);
+  regions = realloc(regions, sizeof(*regions) * (nr_region + 1));
+  assert(regions);
+  regions[nr_region ++] = r;
+  paddr_map_host(r.base, r.size, r.host, !r.readonly);
+  Log("memory region '%s' at [" FMT_PADDR ", " FMT_PADDR "]%s%s%s", r.name, left, right,
+      r.readonly ? ", read-only" : "", file ? ", from " : "", file ? file : "");
+}
+
+void init_mem_regions() {
+  char *spec = strdup(CONFIG_MEM_REGIONS);
+  char *save = NULL;
+  for (char *s = strtok_r(spec, " ", &save); s != NULL; s = strtok_r(NULL, " ", &save)) {
+    add_region(s);
+  }
+  free(spec);
+}
+
+MemRegion* mem_region(paddr_t addr) {
+  for (int i = 0; i < nr_region; i ++) {
+    if (addr - regions[i].base < regions[i].size) return &regions[i];
+  }
+  return NULL;
+}
+#endif
@@ -14,16 +14,153 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/cache.h>
+
+#define TLB_NR CONFIG_TLB_SIZE
+static_assert((TLB_NR & (TLB_NR - 1)) == 0, "TLB size should be a power of 2");
+
+// A TLB entry maps the virtual page `vpage' to the host memory at
+// `vpage + addend', so that a hit costs a compare and an add. Pages
+// without host memory are translated on every access.
+typedef struct {
+  vaddr_t vpage;
+  uintptr_t addend;
+#ifdef CONFIG_CACHESIM
+  paddr_t ppage; // for the cache simulator
+#endif
+} TLBEntry;
+
+#ifdef CONFIG_CACHESIM
+#define CACHE(paddr, len, type) cache_access(paddr, len, type)
+#else
+#define CACHE(paddr, len, type)
+#endif
+#define TLB_CACHE(e, addr, len, type) CACHE((e)->ppage | ((addr) & PAGE_MASK), len, type)
+
+// direct-mapped TLBs for instruction fetch, load and store
+static TLBEntry tlb[3][TLB_NR];
+static uint64_t tlb_hit[3] = {}, tlb_miss[3] = {};
+
+#define tlb_index(addr) (((addr) >> PAGE_SHIFT) & (TLB_NR - 1))
+
+void tlb_flush() {
+  // never matches, since bits of the page offset are cleared in tags except the lowest ones
+  for (int t = 0; t < 3; t ++) {
+    for (int i = 0; i < TLB_NR; i ++) tlb[t][i].vpage = (vaddr_t)-1;
+  }
+}
+
+void tlb_statistic() {
+  static const char *name[3] = { "fetch", "load", "store" };
+  for (int t = 0; t < 3; t ++) {
+    uint64_t total = tlb_hit[t] + tlb_miss[t];
+    if (total == 0) continue;
+    Log("TLB %-5s: hit = %" PRIu64 ", miss = %" PRIu64 ", hit rate = %.2f%%",
+        name[t], tlb_hit[t], tlb_miss[t], tlb_hit[t] * 100.0 / total);
+  }
+}
+
+static paddr_t translate(vaddr_t addr, int len, int type) {
+  paddr_t ret = isa_mmu_translate(addr, len, type);
+  if (unlikely((ret & PAGE_MASK) != MEM_RET_OK)) {
+    cpu_raise_exception(isa_page_fault(addr, type));
+    // not an access of a guest instruction
+    panic("page fault on %s at vaddr = " FMT_WORD ", pc = " FMT_WORD,
+        type == MEM_TYPE_IFETCH ? "fetch" : type == MEM_TYPE_READ ? "load" : "store", addr, cpu.pc);
+  }
+  return (ret & ~(paddr_t)PAGE_MASK) | (addr & PAGE_MASK);
+}
+
+// Return the entry of the page holding `addr', or NULL if the physical page
+// can not be accessed directly, see paddr_host().
+static TLBEntry* tlb_fill(vaddr_t addr, int type) {
+  TLBEntry *e = &tlb[type][tlb_index(addr)];
+  vaddr_t vpage = addr & ~(vaddr_t)PAGE_MASK;
+  if (e->vpage == vpage) { tlb_hit[type] ++; return e; }
+  tlb_miss[type] ++;
+  paddr_t ppage = translate(addr, 1, type) & ~(paddr_t)PAGE_MASK;
+  uint8_t *host = paddr_host(ppage, type == MEM_TYPE_WRITE);
+  if (host == NULL) return NULL;
+  e->vpage = vpage;
+  e->addend = (uintptr_t)host - vpage;
+  IFDEF(CONFIG_CACHESIM, e->ppage = ppage);
+  return e;
+}
+
+// accesses which miss in the TLB, cross a page or are misaligned
+static word_t tlb_read_slow(vaddr_t addr, int len, int type) {
+  if (((addr ^ (addr + len - 1)) & ~(vaddr_t)PAGE_MASK) != 0) {
+    word_t data = 0;
+    for (int i = 0; i < len; i ++) data |= tlb_read_slow(addr + i, 1, type) << (i * 8);
+    return data;
+  }
+  TLBEntry *e = tlb_fill(addr, type);
+  if (e != NULL) {
+    TLB_CACHE(e, addr, len, type);
+    return host_read((void *)(addr + e->addend), len);
+  }
+  return paddr_read(translate(addr, len, type), len);
+}
+
+static void tlb_write_slow(vaddr_t addr, int len, word_t data) {
+  if (((addr ^ (addr + len - 1)) & ~(vaddr_t)PAGE_MASK) != 0) {
+    // a page fault on the second page should leave the first one untouched
+    translate((addr + len - 1) & ~(vaddr_t)PAGE_MASK, 1, MEM_TYPE_WRITE);
+    for (int i = 0; i < len; i ++) tlb_write_slow(addr + i, 1, data >> (i * 8));
+    return;
+  }
+  TLBEntry *e = tlb_fill(addr, MEM_TYPE_WRITE);
+  if (e != NULL) {
+    TLB_CACHE(e, addr, len, MEM_TYPE_WRITE);
+    host_write((void *)(addr + e->addend), len, data);
+    return;
+  }
+  paddr_write(translate(addr, len, MEM_TYPE_WRITE), len, data);
+}
+
+// Misaligned addresses never match the tag, and are handled by the slow path.
+static inline word_t tlb_read(vaddr_t addr, int len, int type) {
+  TLBEntry *e = &tlb[type][tlb_index(addr)];
+  if (likely(e->vpage == (addr & ~(vaddr_t)(PAGE_MASK ^ (len - 1))))) {
+    tlb_hit[type] ++;
+    TLB_CACHE(e, addr, len, type);
+    return host_read((void *)(addr + e->addend), len);
+  }
+  return tlb_read_slow(addr, len, type);
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (isa_mmu_check(addr, len, MEM_TYPE_IFETCH) == MMU_DIRECT) {
+    CACHE(addr, len, MEM_TYPE_IFETCH);
+    return paddr_read(addr, len);
+  }
+  return tlb_read(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT) {
+    CACHE(addr, len, MEM_TYPE_READ);
+    return paddr_read(addr, len);
+  }
+  return tlb_read(addr, len, MEM_TYPE_READ);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  if (isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT) {
+    CACHE(addr, len, MEM_TYPE_WRITE);
+    paddr_write(addr, len, data);
+    return;
+  }
+  TLBEntry *e = &tlb[MEM_TYPE_WRITE][tlb_index(addr)];
+  if (likely(e->vpage == (addr & ~(vaddr_t)(PAGE_MASK ^ (len - 1))))) {
+    tlb_hit[MEM_TYPE_WRITE] ++;
+    TLB_CACHE(e, addr, len, MEM_TYPE_WRITE);
+    host_write((void *)(addr + e->addend), len, data);
+    return;
+  }
+  tlb_write_slow(addr, len, data);
 }
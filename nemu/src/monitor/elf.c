@@ -0,0 +1,127 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <elf.h>
+#include <unistd.h>
+
+#ifndef CONFIG_TARGET_AM
+
+#ifndef EM_LOONGARCH
+#define EM_LOONGARCH 258
+#endif
+
+#define GUEST_EM MUXDEF(CONFIG_ISA_x86, EM_386, MUXDEF(CONFIG_ISA_mips32, EM_MIPS, \
+    MUXDEF(CONFIG_ISA_loongarch32r, EM_LOONGARCH, EM_RISCV)))
+
+typedef struct {
+  const char *name;
+  vaddr_t addr;
+  vaddr_t size;
+} Symbol;
+
+// function and object symbols sorted by address
+static Symbol *syms = NULL;
+static int nr_sym = 0;
+static char *strtab = NULL;
+
+static void* read_at(int fd, uint64_t off, uint64_t len) {
+  void *buf = malloc(len);
+  assert(buf);
+  ssize_t ret = pread(fd, buf, len, off);
+  Assert(ret == len, "Can not read the ELF file at offset %" PRIu64, off);
+  return buf;
+}
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symbols(int fd, const Elf32_Ehdr *eh) {
+  if (eh->e_shoff == 0) return;
+  Elf32_Shdr *sh = read_at(fd, eh->e_shoff, sizeof(*sh) * eh->e_shnum);
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    Elf32_Sym *st = read_at(fd, sh[i].sh_offset, sh[i].sh_size);
+    int n = sh[i].sh_size / sizeof(*st);
+    strtab = read_at(fd, sh[sh[i].sh_link].sh_offset, sh[sh[i].sh_link].sh_size);
+    syms = malloc(sizeof(*syms) * n);
+    assert(syms);
+    for (int j = 0; j < n; j ++) {
+      int type = ELF32_ST_TYPE(st[j].st_info);
+      if ((type == STT_FUNC || type == STT_OBJECT) && st[j].st_name < sh[sh[i].sh_link].sh_size) {
+        syms[nr_sym ++] = (Symbol){ .name = strtab + st[j].st_name,
+          .addr = st[j].st_value, .size = st[j].st_size };
+      }
+    }
+    qsort(syms, nr_sym, sizeof(*syms), sym_cmp);
+    free(st);
+    break;
+  }
+  free(sh);
+}
+
+// Load the PT_LOAD segments of the ELF file to pmem, and start from its
+// entry. Return the size of the image counted from RESET_VECTOR.
+long load_elf(const char *file, int fd) {
+  Elf32_Ehdr *eh = read_at(fd, 0, sizeof(*eh));
+  Assert(eh->e_ident[EI_CLASS] == ELFCLASS32 && eh->e_machine == GUEST_EM,
+      "%s is not a 32-bit ELF file for %s", file, str(__GUEST_ISA__));
+
+  Elf32_Phdr *ph = read_at(fd, eh->e_phoff, sizeof(*ph) * eh->e_phnum);
+  paddr_t end = RESET_VECTOR;
+  for (int i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    paddr_t addr = ph[i].p_paddr;
+    Assert(in_pmem(addr) && in_pmem(addr + ph[i].p_memsz - 1),
+        "Segment [" FMT_PADDR ", " FMT_PADDR ") of %s is out of bound of pmem",
+        addr, (paddr_t)(addr + ph[i].p_memsz), file);
+    pmem_load_file(addr, fd, ph[i].p_offset, ph[i].p_filesz);
+    if (ph[i].p_memsz > ph[i].p_filesz) {
+      memset(guest_to_host(addr + ph[i].p_filesz), 0, ph[i].p_memsz - ph[i].p_filesz);
+    }
+    if (addr + ph[i].p_memsz > end) end = addr + ph[i].p_memsz;
+  }
+  free(ph);
+
+  load_symbols(fd, eh);
+  cpu.pc = eh->e_entry;
+  Log("The image is %s, an ELF file, entry = " FMT_WORD ", %d symbols", file, cpu.pc, nr_sym);
+  free(eh);
+  return end - RESET_VECTOR;
+}
+
+bool elf_symbol_addr(const char *name, vaddr_t *addr) {
+  for (int i = 0; i < nr_sym; i ++) {
+    if (strcmp(syms[i].name, name) == 0) { *addr = syms[i].addr; return true; }
+  }
+  return false;
+}
+
+const char* elf_symbol_name(vaddr_t addr, vaddr_t *offset) {
+  // the last symbol starting at or below `addr'
+  int l = 0, r = nr_sym - 1, idx = -1;
+  while (l <= r) {
+    int m = (l + r) / 2;
+    if (syms[m].addr <= addr) { idx = m; l = m + 1; }
+    else r = m - 1;
+  }
+  if (idx == -1 || (syms[idx].size != 0 && addr - syms[idx].addr >= syms[idx].size)) return NULL;
+  if (offset != NULL) *offset = addr - syms[idx].addr;
+  return syms[idx].name;
+}
+#endif
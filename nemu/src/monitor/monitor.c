@@ -14,6 +14,8 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/aot.h>
 #include <memory/paddr.h>
 
 void init_rand();
@@ -23,6 +25,7 @@ void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm();
+long load_elf(const char *file, int fd);
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -38,6 +41,10 @@ static void welcome() {
 
 #ifndef CONFIG_TARGET_AM
 #include <getopt.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 void sdb_set_batch_mode();
 
@@ -45,6 +52,8 @@ static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+static bool trace = true;
+static char *aot_file = NULL;
 
 static long load_img() {
   if (img_file == NULL) {
@@ -52,19 +61,23 @@ static long load_img() {
     return 4096; // built-in image size
   }
 
-  FILE *fp = fopen(img_file, "rb");
-  Assert(fp, "Can not open '%s'", img_file);
-
-  fseek(fp, 0, SEEK_END);
-  long size = ftell(fp);
-
-  Log("The image is %s, size = %ld", img_file, size);
-
-  fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
-  assert(ret == 1);
+  int fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", img_file);
+
+  long size;
+  char magic[SELFMAG];
+  if (pread(fd, magic, SELFMAG, 0) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+    size = load_elf(img_file, fd);
+  } else {
+    struct stat st;
+    int ret = fstat(fd, &st);
+    assert(ret == 0);
+    size = st.st_size;
+    Log("The image is %s, size = %ld", img_file, size);
+    pmem_load_file(RESET_VECTOR, fd, 0, size);
+  }
 
-  fclose(fp);
+  close(fd);
   return size;
 }
 
@@ -74,16 +87,20 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"trace"    , required_argument, NULL, 't'},
+    {"aot"      , required_argument, NULL, 'a'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:t:a:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 't': trace = (strcmp(optarg, "off") != 0); break;
+      case 'a': aot_file = optarg; break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -91,6 +108,8 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-t,--trace=on|off       start with itrace and DiffTest on or off\n");
+        printf("\t-a,--aot=SO             run the code translated by tools/aot in SO\n");
         printf("\n");
         exit(0);
     }
@@ -124,6 +143,14 @@ void init_monitor(int argc, char *argv[]) {
 
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
+  if (!trace) cpu_set_trace(false);
+
+  /* Load the code translated ahead of time. */
+#ifdef CONFIG_AOT
+  init_aot(aot_file);
+#else
+  if (aot_file != NULL) Log("AOT is not enabled in menuconfig, %s is ignored", aot_file);
+#endif
 
   /* Initialize the simple debugger. */
   init_sdb();
@@ -21,6 +21,7 @@
 #include <regex.h>
 
 #include "memory/vaddr.h"
+#include "memory/cache.h"
 
 // #define Log(...) (printf(__VA_ARGS__)
 
@@ -352,7 +353,15 @@ static word_t eval(int level)
     }
     else
     {
-      error = true;
+      vaddr_t addr;
+      if (elf_symbol_addr(str, &addr))
+      {
+        lval = addr;
+      }
+      else
+      {
+        error = true;
+      }
     }
     break;
   case TK_LPAREN:
@@ -366,7 +375,10 @@ static word_t eval(int level)
     break;
   case TK_MUL:
     lval = eval(TK_NUM);
+    // not an access of the guest
+    IFDEF(CONFIG_CACHESIM, cache_bypass = true);
     lval = vaddr_read(lval, sizeof(word_t));
+    IFDEF(CONFIG_CACHESIM, cache_bypass = false);
     parse_index++;
     break;
   default:
@@ -148,6 +148,18 @@ static int cmd_p(char *args)
   return 0;
 }
 
+static int cmd_trace(char *args)
+{
+  char *arg = strtok(args, " ");
+  if (arg != NULL && strcmp(arg, "on") == 0)
+    cpu_set_trace(true);
+  else if (arg != NULL && strcmp(arg, "off") == 0)
+    cpu_set_trace(false);
+  else
+    printf("Usage: trace on|off\n");
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct
@@ -168,6 +180,7 @@ static struct
     {"w", "Create a watchpoint", cmd_w},
     // Probably cause segmentation fault
     {"d", "Delete a watchpoint", cmd_d},
+    {"trace", "Turn itrace and difftest on or off", cmd_trace},
 
     /* TODO: Add more commands */
 
@@ -237,11 +250,6 @@ void sdb_mainloop()
       args = NULL;
     }
 
-#ifdef CONFIG_DEVICE
-    extern void sdl_clear_event_queue();
-    sdl_clear_event_queue();
-#endif
-
     int i;
     for (i = 0; i < NR_CMD; i++)
     {
@@ -19,6 +19,7 @@ void init_monitor(int, char *[]);
 void am_init_monitor();
 void engine_start();
 int is_exit_status_bad();
+void sdl_mainloop(void (*engine)());
 
 int main(int argc, char *argv[]) {
   /* Initialize the monitor. */
@@ -29,7 +30,11 @@ int main(int argc, char *argv[]) {
 #endif
 
   /* Start engine. */
+#if defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_TARGET_AM)
+  sdl_mainloop(engine_start);
+#else
   engine_start();
+#endif
 
   return is_exit_status_bad();
 }
@@ -0,0 +1,528 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Translate a riscv32 guest image into C code ahead of time.
+// The code is compiled into a shared object loaded by NEMU with --aot=SO.
+//
+// Basic blocks are discovered by following the control flow from the entry
+// (and from the function symbols of an ELF file). A block ends at a branch,
+// a jump, or an instruction which is not translated, such as CSR accesses
+// and environment calls. The generated aot_exec() runs blocks until it
+// reaches a pc which does not start a translated block, and NEMU executes
+// the code from there until it enters a translated block again.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <getopt.h>
+#include <elf.h>
+#include <aot-def.h>
+
+#define BITS(x, hi, lo) (((x) >> (lo)) & ((1ull << ((hi) - (lo) + 1)) - 1))
+#define SEXT(x, len) ((uint32_t)((int32_t)((uint32_t)(x) << (32 - (len))) >> (32 - (len))))
+
+static uint8_t *img = NULL;
+static uint32_t img_base = 0x80000000, img_size = 0, entry = 0;
+static bool has_entry = false;
+static const char *out_file = NULL;
+
+// ---------- image loading ----------
+
+static uint8_t *read_file(const char *name, long *size) {
+  FILE *fp = fopen(name, "rb");
+  if (fp == NULL) { perror(name); exit(1); }
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(*size);
+  assert(buf);
+  int ret = fread(buf, *size, 1, fp);
+  assert(ret == 1 || *size == 0);
+  fclose(fp);
+  return buf;
+}
+
+#define NR_ROOT_MAX 65536
+static uint32_t roots[NR_ROOT_MAX];
+static int nr_root = 0;
+
+static void add_root(uint32_t pc) {
+  if (nr_root < NR_ROOT_MAX) roots[nr_root ++] = pc;
+}
+
+// load the segments of an ELF file, and use its function symbols as roots
+static void load_elf(uint8_t *buf, long size) {
+  Elf32_Ehdr *eh = (void *)buf;
+  if (eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_machine != EM_RISCV) {
+    fprintf(stderr, "only riscv32 ELF files are supported\n");
+    exit(1);
+  }
+  Elf32_Phdr *ph = (void *)(buf + eh->e_phoff);
+  uint32_t lo = UINT32_MAX, hi = 0;
+  for (int i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_filesz == 0) continue;
+    if (ph[i].p_paddr < lo) lo = ph[i].p_paddr;
+    if (ph[i].p_paddr + ph[i].p_filesz > hi) hi = ph[i].p_paddr + ph[i].p_filesz;
+  }
+  if (lo >= hi) { fprintf(stderr, "no loadable segment\n"); exit(1); }
+  // the same layout as the flat binary generated by `objcopy -O binary'
+  img_base = lo;
+  img_size = hi - lo;
+  img = calloc(img_size, 1);
+  assert(img);
+  for (int i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_filesz == 0) continue;
+    memcpy(img + ph[i].p_paddr - lo, buf + ph[i].p_offset, ph[i].p_filesz);
+  }
+  if (!has_entry) { entry = eh->e_entry; has_entry = true; }
+
+  Elf32_Shdr *sh = (void *)(buf + eh->e_shoff);
+  for (int i = 0; eh->e_shoff != 0 && i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Elf32_Sym *sym = (void *)(buf + sh[i].sh_offset);
+    int nr = sh[i].sh_size / sizeof(Elf32_Sym);
+    for (int j = 0; j < nr; j ++) {
+      if (ELF32_ST_TYPE(sym[j].st_info) == STT_FUNC && sym[j].st_shndx != SHN_UNDEF) {
+        add_root(sym[j].st_value);
+      }
+    }
+  }
+  (void)size;
+}
+
+static void load_image(const char *name) {
+  long size;
+  uint8_t *buf = read_file(name, &size);
+  if (size >= (long)sizeof(Elf32_Ehdr) && memcmp(buf, ELFMAG, SELFMAG) == 0) {
+    load_elf(buf, size);
+    free(buf);
+  } else {
+    img = buf;
+    img_size = size;
+    if (!has_entry) { entry = img_base; has_entry = true; }
+  }
+}
+
+static bool in_img(uint32_t pc) {
+  return (pc & 3) == 0 && pc - img_base < img_size && img_size - (pc - img_base) >= 4;
+}
+
+static uint32_t fetch(uint32_t pc) {
+  uint32_t inst;
+  memcpy(&inst, img + pc - img_base, 4);
+  return inst;
+}
+
+// ---------- discovery ----------
+
+enum { K_NORMAL, K_BRANCH, K_JAL, K_JALR, K_STOP };
+
+enum {
+  F_REACHED = 1,  // the instruction is on a discovered path
+  F_LEADER  = 2,  // control flow may enter here from somewhere else
+};
+static uint8_t *flag;
+static int *block_id;  // index of the block starting at each word, or -1
+#define IDX(pc) (((pc) - img_base) >> 2)
+
+static int classify(uint32_t i) {
+  // compressed instructions are left to NEMU
+  if ((i & 0x3) != 0x3) return K_STOP;
+  uint32_t f3 = BITS(i, 14, 12), f7 = BITS(i, 31, 25);
+  switch (BITS(i, 6, 0)) {
+    case 0b0110111: case 0b0010111: return K_NORMAL; // lui, auipc
+    case 0b1101111: return K_JAL;
+    case 0b1100111: return f3 == 0 ? K_JALR : K_STOP;
+    case 0b1100011: return (f3 == 2 || f3 == 3) ? K_STOP : K_BRANCH;
+    case 0b0000011: return (f3 == 3 || f3 >= 6) ? K_STOP : K_NORMAL;
+    case 0b0100011: return f3 <= 2 ? K_NORMAL : K_STOP;
+    case 0b0010011:
+      if (f3 == 1) return f7 == 0 ? K_NORMAL : K_STOP;
+      if (f3 == 5) return (f7 == 0 || f7 == 0x20) ? K_NORMAL : K_STOP;
+      return K_NORMAL;
+    case 0b0110011:
+      if (f7 == 0 || f7 == 1) return K_NORMAL;
+      if (f7 == 0x20 && (f3 == 0 || f3 == 5)) return K_NORMAL;
+      return K_STOP;
+    case 0b0001111: return K_NORMAL; // fence, fence.i
+    default: return K_STOP;
+  }
+}
+
+static uint32_t imm_i(uint32_t i) { return SEXT(BITS(i, 31, 20), 12); }
+static uint32_t imm_s(uint32_t i) { return SEXT((BITS(i, 31, 25) << 5) | BITS(i, 11, 7), 12); }
+static uint32_t imm_b(uint32_t i) {
+  return SEXT((BITS(i, 31, 31) << 12) | (BITS(i, 7, 7) << 11) | (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1), 13);
+}
+static uint32_t imm_j(uint32_t i) {
+  return SEXT((BITS(i, 31, 31) << 20) | (BITS(i, 19, 12) << 12) | (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1), 21);
+}
+
+static uint32_t *worklist;
+static int nr_work = 0;
+
+static void leader(uint32_t pc) {
+  if (!in_img(pc) || (flag[IDX(pc)] & F_LEADER)) return;
+  flag[IDX(pc)] |= F_LEADER;
+  worklist[nr_work ++] = pc;
+}
+
+// Walk along the fall-through path from `pc'. Constants built by lui/auipc
+// and addi are tracked, so that the targets of `la reg, sym; jalr reg' are
+// discovered as well.
+static void walk(uint32_t pc) {
+  bool known[32] = {};
+  uint32_t val[32];
+  while (in_img(pc) && !(flag[IDX(pc)] & F_REACHED)) {
+    flag[IDX(pc)] |= F_REACHED;
+    uint32_t i = fetch(pc);
+    uint32_t rd = BITS(i, 11, 7), rs1 = BITS(i, 19, 15);
+    int kind = classify(i);
+    switch (kind) {
+      case K_BRANCH: leader(pc + imm_b(i)); leader(pc + 4); return;
+      case K_JAL: leader(pc + imm_j(i)); if (rd != 0) leader(pc + 4); return;
+      case K_JALR:
+        if (known[rs1]) leader((val[rs1] + imm_i(i)) & ~1u);
+        if (rd != 0) leader(pc + 4);
+        return;
+      case K_STOP:
+        // CSR accesses and environment calls usually return to the next instruction
+        if (BITS(i, 6, 0) == 0b1110011) leader(pc + 4);
+        return;
+    }
+    uint32_t op = BITS(i, 6, 0);
+    bool k = false;
+    uint32_t v = 0;
+    if (op == 0b0110111) { k = true; v = i & 0xfffff000; }
+    else if (op == 0b0010111) { k = true; v = pc + (i & 0xfffff000); }
+    else if (op == 0b0010011 && BITS(i, 14, 12) == 0 && known[rs1]) { k = true; v = val[rs1] + imm_i(i); }
+    if (rd != 0) { known[rd] = k; val[rd] = v; }
+    pc += 4;
+  }
+}
+
+static void discover() {
+  flag = calloc(img_size / 4 + 1, 1);
+  worklist = malloc(sizeof(uint32_t) * (img_size / 4 + 1));
+  assert(flag && worklist);
+  leader(entry);
+  for (int i = 0; i < nr_root; i ++) leader(roots[i]);
+  while (nr_work > 0) walk(worklist[-- nr_work]);
+}
+
+// ---------- blocks ----------
+
+typedef struct {
+  uint32_t pc;
+  uint32_t len;
+} Block;
+
+static Block *blocks;
+static int nr_block = 0;
+
+static bool translatable(uint32_t pc) {
+  return in_img(pc) && (flag[IDX(pc)] & F_REACHED) && classify(fetch(pc)) != K_STOP;
+}
+
+static bool ends_block(uint32_t pc) {
+  int kind = classify(fetch(pc));
+  return kind == K_BRANCH || kind == K_JAL || kind == K_JALR;
+}
+
+static void form_blocks() {
+  block_id = malloc(sizeof(int) * (img_size / 4 + 1));
+  blocks = malloc(sizeof(Block) * (img_size / 4 + 1));
+  assert(block_id && blocks);
+  bool in_block = false;
+  for (uint32_t pc = img_base; in_img(pc); pc += 4) {
+    block_id[IDX(pc)] = -1;
+    if (!translatable(pc)) { in_block = false; continue; }
+    if (!in_block || (flag[IDX(pc)] & F_LEADER)) {
+      block_id[IDX(pc)] = nr_block;
+      blocks[nr_block ++] = (Block){ .pc = pc, .len = 0 };
+    }
+    blocks[nr_block - 1].len ++;
+    in_block = !ends_block(pc);
+  }
+}
+
+// ---------- code generation ----------
+
+static FILE *out;
+
+static const char *reg(uint32_t r) {
+  static char buf[4][8];
+  static int n = 0;
+  if (r == 0) return "0u";
+  char *p = buf[n ++ % 4];
+  sprintf(p, "x%u", r);
+  return p;
+}
+
+static void emit_goto(uint32_t target) {
+  if (in_img(target) && block_id[IDX(target)] >= 0) fprintf(out, "goto b%d;", block_id[IDX(target)]);
+  else fprintf(out, "{ pc = 0x%08xu; goto out; }", target);
+}
+
+// `rest' is the number of instructions in the block after this one
+static void emit_inst(uint32_t pc, uint32_t rest) {
+  uint32_t i = fetch(pc);
+  uint32_t op = BITS(i, 6, 0), f3 = BITS(i, 14, 12), f7 = BITS(i, 31, 25);
+  uint32_t rd = BITS(i, 11, 7);
+  const char *s1 = reg(BITS(i, 19, 15)), *s2 = reg(BITS(i, 24, 20));
+  char d[16];
+  // writes to $zero are dropped, but loads are still performed
+  if (rd == 0) strcpy(d, "(void)");
+  else sprintf(d, "x%u = ", rd);
+
+  fprintf(out, "  /* %08x: %08x */ ", pc, i);
+  bool alu = (op == 0b0110111 || op == 0b0010111 || op == 0b0010011 || op == 0b0110011);
+  if (alu && rd == 0) { fprintf(out, "/* nop */\n"); return; }
+  switch (op) {
+    case 0b0110111: fprintf(out, "%s0x%08xu;\n", d, i & 0xfffff000); return;
+    case 0b0010111: fprintf(out, "%s0x%08xu;\n", d, pc + (i & 0xfffff000)); return;
+    case 0b1101111:
+      fprintf(out, "%s0x%08xu; ", d, pc + 4);
+      emit_goto(pc + imm_j(i));
+      fprintf(out, "\n");
+      return;
+    case 0b1100111:
+      fprintf(out, "t = (%s + 0x%08xu) & ~1u; %s0x%08xu; pc = t; goto dispatch;\n", s1, imm_i(i), d, pc + 4);
+      return;
+    case 0b1100011: {
+      static const char *cond[] = {
+        [0] = "%s == %s", [1] = "%s != %s", [4] = "(int32_t)%s < (int32_t)%s",
+        [5] = "(int32_t)%s >= (int32_t)%s", [6] = "%s < %s", [7] = "%s >= %s",
+      };
+      fprintf(out, "if (");
+      fprintf(out, cond[f3], s1, s2);
+      fprintf(out, ") ");
+      emit_goto(pc + imm_b(i));
+      fprintf(out, " ");
+      emit_goto(pc + 4);
+      fprintf(out, "\n");
+      return;
+    }
+    case 0b0000011: {
+      static const char *load[] = {
+        [0] = "(uint32_t)(int8_t)ld(%s + 0x%08xu, 1)", [1] = "(uint32_t)(int16_t)ld(%s + 0x%08xu, 2)",
+        [2] = "ld(%s + 0x%08xu, 4)", [4] = "ld(%s + 0x%08xu, 1)", [5] = "ld(%s + 0x%08xu, 2)",
+      };
+      fprintf(out, "%s", d);
+      fprintf(out, load[f3], s1, imm_i(i));
+      fprintf(out, ";\n");
+      return;
+    }
+    case 0b0100011:
+      fprintf(out, "if (unlikely(st(%s + 0x%08xu, %d, %s) && *ctx.exit_request)) "
+          "{ icount -= %u; pc = 0x%08xu; goto out; }\n", s1, imm_s(i), 1 << f3, s2, rest, pc + 4);
+      return;
+    case 0b0010011: {
+      uint32_t imm = imm_i(i), sh = imm & 0x1f;
+      switch (f3) {
+        case 0: fprintf(out, "%s%s + 0x%08xu;\n", d, s1, imm); break;
+        case 1: fprintf(out, "%s%s << %u;\n", d, s1, sh); break;
+        case 2: fprintf(out, "%s(int32_t)%s < (int32_t)0x%08xu;\n", d, s1, imm); break;
+        case 3: fprintf(out, "%s%s < 0x%08xu;\n", d, s1, imm); break;
+        case 4: fprintf(out, "%s%s ^ 0x%08xu;\n", d, s1, imm); break;
+        case 5: if (f7 == 0) fprintf(out, "%s%s >> %u;\n", d, s1, sh);
+                else fprintf(out, "%s(uint32_t)((int32_t)%s >> %u);\n", d, s1, sh);
+                break;
+        case 6: fprintf(out, "%s%s | 0x%08xu;\n", d, s1, imm); break;
+        case 7: fprintf(out, "%s%s & 0x%08xu;\n", d, s1, imm); break;
+      }
+      return;
+    }
+    case 0b0110011: {
+      static const char *alu[] = {
+        "%s + %s", "%s << (%s & 31)", "(int32_t)%s < (int32_t)%s", "%s < %s",
+        "%s ^ %s", "%s >> (%s & 31)", "%s | %s", "%s & %s",
+      };
+      static const char *mul[] = {
+        "%s * %s", "mulh(%s, %s)", "mulhsu(%s, %s)", "mulhu(%s, %s)",
+        "div_s(%s, %s)", "div_u(%s, %s)", "rem_s(%s, %s)", "rem_u(%s, %s)",
+      };
+      fprintf(out, "%s", d);
+      if (f7 == 1) fprintf(out, mul[f3], s1, s2);
+      else if (f7 == 0x20 && f3 == 0) fprintf(out, "%s - %s", s1, s2);
+      else if (f7 == 0x20 && f3 == 5) fprintf(out, "(uint32_t)((int32_t)%s >> (%s & 31))", s1, s2);
+      else fprintf(out, alu[f3], s1, s2);
+      fprintf(out, ";\n");
+      return;
+    }
+    case 0b0001111: fprintf(out, "/* fence */\n"); return;
+  }
+  assert(0);
+}
+
+static const char *prelude =
+  "#include <string.h>\n"
+  "#include <aot-def.h>\n"
+  "\n"
+  "#define likely(cond)   __builtin_expect(cond, 1)\n"
+  "#define unlikely(cond) __builtin_expect(cond, 0)\n"
+  "#define EXPORT __attribute__((visibility(\"default\")))\n"
+  "\n"
+  "static AOTContext ctx;\n"
+  "\n"
+  "static inline uint32_t ld(uint32_t addr, int len) {\n"
+  "  uint32_t off = addr - ctx.pmem_base;\n"
+  "  if (likely(off <= ctx.pmem_size - len)) {\n"
+  "    uint32_t v = 0;\n"
+  "    memcpy(&v, ctx.pmem + off, len);\n"
+  "    return v;\n"
+  "  }\n"
+  "  return ctx.read(addr, len);\n"
+  "}\n"
+  "\n"
+  "// return true if the store is handled by NEMU\n"
+  "static inline bool st(uint32_t addr, int len, uint32_t data) {\n"
+  "  uint32_t off = addr - ctx.pmem_base;\n"
+  "  if (likely(off <= ctx.pmem_size - len && !ctx.code_page[off >> ctx.page_shift] &&\n"
+  "        !ctx.code_page[(off + len - 1) >> ctx.page_shift])) {\n"
+  "    memcpy(ctx.pmem + off, &data, len);\n"
+  "    return false;\n"
+  "  }\n"
+  "  ctx.write(addr, len, data);\n"
+  "  return true;\n"
+  "}\n"
+  "\n"
+  "static inline uint32_t mulh(uint32_t a, uint32_t b) { return ((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32; }\n"
+  "static inline uint32_t mulhsu(uint32_t a, uint32_t b) { return ((int64_t)(int32_t)a * (int64_t)(uint64_t)b) >> 32; }\n"
+  "static inline uint32_t mulhu(uint32_t a, uint32_t b) { return ((uint64_t)a * (uint64_t)b) >> 32; }\n"
+  "static inline uint32_t div_s(uint32_t a, uint32_t b) {\n"
+  "  return b == 0 ? -1 : ((int32_t)a == INT32_MIN && (int32_t)b == -1) ? a : (uint32_t)((int32_t)a / (int32_t)b);\n"
+  "}\n"
+  "static inline uint32_t div_u(uint32_t a, uint32_t b) { return b == 0 ? -1 : a / b; }\n"
+  "static inline uint32_t rem_s(uint32_t a, uint32_t b) {\n"
+  "  return b == 0 ? a : ((int32_t)a == INT32_MIN && (int32_t)b == -1) ? 0 : (uint32_t)((int32_t)a % (int32_t)b);\n"
+  "}\n"
+  "static inline uint32_t rem_u(uint32_t a, uint32_t b) { return b == 0 ? a : a % b; }\n"
+  "\n";
+
+static void emit() {
+  fprintf(out, "// generated by tools/aot, do not edit\n");
+  fputs(prelude, out);
+
+  fprintf(out, "#define NR_BLOCK %d\n", nr_block);
+  fprintf(out, "static const uint32_t block_pc[NR_BLOCK + 1] = {");
+  for (int b = 0; b < nr_block; b ++) fprintf(out, "%s0x%08xu,", b % 8 ? " " : "\n  ", blocks[b].pc);
+  fprintf(out, "\n};\nstatic const uint32_t block_len[NR_BLOCK + 1] = {");
+  for (int b = 0; b < nr_block; b ++) fprintf(out, "%s%u,", b % 16 ? " " : "\n  ", blocks[b].len);
+  fprintf(out, "\n};\nstatic bool valid[NR_BLOCK + 1];\n\n");
+
+  fprintf(out, "EXPORT const AOTInfo aot_info = {\n"
+      "  .version = AOT_VERSION, .base = 0x%08xu, .size = 0x%08xu, .checksum = 0x%016llxull,\n"
+      "  .nr_block = NR_BLOCK, .block_pc = block_pc, .block_len = block_len,\n};\n\n",
+      img_base, img_size, (unsigned long long)aot_checksum(img, img_size));
+
+  fprintf(out,
+      "EXPORT void aot_init(const AOTContext *c) {\n"
+      "  ctx = *c;\n"
+      "  memset(valid, 1, sizeof(valid));\n"
+      "}\n\n"
+      "EXPORT void aot_invalidate(uint32_t addr, int len) {\n"
+      "  // blocks are sorted by pc and do not overlap\n"
+      "  int l = 0, r = NR_BLOCK;\n"
+      "  while (l < r) {\n"
+      "    int m = (l + r) / 2;\n"
+      "    if (block_pc[m] + block_len[m] * 4 <= addr) l = m + 1; else r = m;\n"
+      "  }\n"
+      "  for (; l < NR_BLOCK && block_pc[l] < addr + len; l ++) {\n"
+      "    valid[l] = false;\n"
+      "    *ctx.exit_request = true;\n"
+      "  }\n"
+      "}\n\n");
+
+  fprintf(out, "EXPORT uint64_t aot_exec(uint64_t n) {\n");
+  fprintf(out, "  uint32_t *gpr = ctx.gpr, pc = *ctx.pc, t;\n  uint64_t icount = 0;\n");
+  for (int r = 1; r < 32; r ++) fprintf(out, "  uint32_t x%d = gpr[%d];\n", r, r);
+  fprintf(out, "  (void)t;\n\ndispatch:\n  switch (pc) {\n");
+  for (int b = 0; b < nr_block; b ++) fprintf(out, "    case 0x%08xu: goto b%d;\n", blocks[b].pc, b);
+  fprintf(out, "    default: goto out;\n  }\n");
+
+  for (int b = 0; b < nr_block; b ++) {
+    Block *blk = &blocks[b];
+    fprintf(out, "\nb%d:\n", b);
+    fprintf(out, "  if (unlikely(!valid[%d] || icount + %u > n)) { pc = 0x%08xu; goto out; }\n",
+        b, blk->len, blk->pc);
+    fprintf(out, "  icount += %u;\n", blk->len);
+    for (uint32_t k = 0; k < blk->len; k ++) {
+      emit_inst(blk->pc + k * 4, blk->len - k - 1);
+    }
+    uint32_t last = blk->pc + (blk->len - 1) * 4;
+    if (!ends_block(last)) {
+      fprintf(out, "  ");
+      emit_goto(last + 4);
+      fprintf(out, "\n");
+    }
+  }
+
+  fprintf(out, "\nout:\n");
+  for (int r = 1; r < 32; r ++) fprintf(out, "  gpr[%d] = x%d;\n", r, r);
+  fprintf(out, "  *ctx.pc = pc;\n  return icount;\n}\n");
+}
+
+// ---------- main ----------
+
+static void parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"base"     , required_argument, NULL, 'b'},
+    {"entry"    , required_argument, NULL, 'e'},
+    {"output"   , required_argument, NULL, 'o'},
+    {"help"     , no_argument      , NULL, 'h'},
+    {0          , 0                , NULL,  0 },
+  };
+  int o;
+  while ( (o = getopt_long(argc, argv, "b:e:o:h", table, NULL)) != -1) {
+    switch (o) {
+      case 'b': img_base = strtoul(optarg, NULL, 0); break;
+      case 'e': entry = strtoul(optarg, NULL, 0); has_entry = true; break;
+      case 'o': out_file = optarg; break;
+      default:
+        printf("Usage: %s [OPTION...] IMAGE\n\n", argv[0]);
+        printf("\t-b,--base=ADDR          load a flat binary at ADDR (default 0x80000000)\n");
+        printf("\t-e,--entry=ADDR         start discovering code from ADDR\n");
+        printf("\t-o,--output=FILE        write the C code to FILE instead of stdout\n");
+        printf("\n");
+        exit(0);
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "%s: one image is expected, see --help\n", argv[0]);
+    exit(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+  load_image(argv[optind]);
+  discover();
+  form_blocks();
+
+  out = (out_file ? fopen(out_file, "w") : stdout);
+  if (out == NULL) { perror(out_file); return 1; }
+  emit();
+  if (out != stdout) fclose(out);
+
+  uint32_t nr_inst = 0;
+  for (int b = 0; b < nr_block; b ++) nr_inst += blocks[b].len;
+  fprintf(stderr, "aot: %d blocks, %u instructions, image [0x%08x, 0x%08x)\n",
+      nr_block, nr_inst, img_base, img_base + img_size);
+  return 0;
+}
@@ -22,6 +22,9 @@ ARGS_DIFF = --diff=$(DIFF_REF_SO)
 ifndef CONFIG_DIFFTEST_REF_NEMU
 $(DIFF_REF_SO):
 	$(MAKE) -s -C $(DIFF_REF_PATH) $(MKFLAGS)
+else
+$(DIFF_REF_SO):
+	@test -f $@ || (echo "$@ not found, build NEMU with the interpreter engine as a shared object first" && false)
 endif
 
 .PHONY: $(DIFF_REF_SO)
@@ -0,0 +1,100 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Generate a random riscv32 program of instructions which all have RVC
+// forms, for checking the RVC expansion in NEMU. Assemble the output twice,
+// with -march=rv32imc and rv32im (and without linker relaxation), convert
+// them to raw images at 0x80000000, and run both under DiffTest. The program
+// ends with a good trap after storing x1-x31 at 0x80010000, which should be
+// the same for the two images. Usage: gen-rvc [seed] [number of instructions]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// registers with 3-bit encodings (x8-x15), except s1 which holds the base of c.lw/c.sw
+static const char *creg[] = { "s0", "a0", "a1", "a2", "a3", "a4", "a5" };
+// all registers except zero, sp and s1
+static const char *reg[] = {
+  "ra", "gp", "tp", "t0", "t1", "t2", "s0", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+  "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+#define NR(a) (int)(sizeof(a) / sizeof(a[0]))
+#define choose(n) (rand() % (n))
+
+static int label = 0;
+
+static int rand_imm(int lo, int hi) { return lo + choose(hi - lo); }
+static int rand_nz6() { int i; do { i = rand_imm(-32, 32); } while (i == 0); return i; }
+static int32_t rand_word() { return (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand()); }
+
+static void gen_inst() {
+  const char *rd = reg[choose(NR(reg))], *rs = reg[choose(NR(reg))];
+  const char *cd = creg[choose(NR(creg))], *cs = creg[choose(NR(creg))];
+  static const char *alu[] = { "sub", "xor", "or", "and" };
+  int l = ++ label;
+  switch (choose(22)) {
+    case 0: printf("  addi %s, %s, %d\n", rd, rd, rand_nz6()); break;
+    case 1: printf("  li %s, %d\n", rd, rand_imm(-32, 32)); break;
+    case 2: printf("  lui %s, %d\n", rd, choose(2) ? rand_imm(1, 32) : rand_imm(0xfffe0, 0x100000)); break;
+    case 3: printf("  slli %s, %s, %d\n", rd, rd, rand_imm(1, 32)); break;
+    case 4: printf("  srli %s, %s, %d\n", cd, cd, rand_imm(1, 32)); break;
+    case 5: printf("  srai %s, %s, %d\n", cd, cd, rand_imm(1, 32)); break;
+    case 6: printf("  andi %s, %s, %d\n", cd, cd, rand_imm(-32, 32)); break;
+    case 7: printf("  add %s, %s, %s\n", rd, rd, rs); break;
+    case 8: printf("  mv %s, %s\n", rd, rs); break;
+    case 9: printf("  %s %s, %s, %s\n", alu[choose(NR(alu))], cd, cd, cs); break;
+    case 10: printf("  lw %s, %d(sp)\n", rd, choose(64) * 4); break;
+    case 11: printf("  sw %s, %d(sp)\n", rs, choose(64) * 4); break;
+    case 12: printf("  lw %s, %d(s1)\n", cd, choose(32) * 4); break;
+    case 13: printf("  sw %s, %d(s1)\n", cs, choose(32) * 4); break;
+    case 14:
+      printf("  %s %s, L%d\n  addi %s, %s, %d\nL%d:\n", choose(2) ? "beqz" : "bnez", cd, l, rd, rd, rand_nz6(), l);
+      break;
+    case 15: printf("  j L%d\n  addi %s, %s, 1\nL%d:\n", l, rd, rd, l); break;
+    // the link register minus the return address is 0 in both images,
+    // and t0 holding a code address is overwritten
+    case 16: printf("  jal L%d\nL%d:\n  la t0, L%d\n  sub ra, ra, t0\n", l, l, l); goto reset_t0;
+    case 17: printf("  la t0, L%d\n  jr t0\n  addi %s, %s, 1\nL%d:\n", l, rd, rd, l); goto reset_t0;
+    case 18: printf("  la t0, L%d\n  jalr t0\nL%d:\n  sub ra, ra, t0\n", l, l); goto reset_t0;
+    case 19: printf("  addi %s, sp, %d\n", cd, rand_imm(1, 256) * 4); break;
+    case 20: {
+      int imm = rand_nz6() * 16;
+      printf("  addi sp, sp, %d\n  addi sp, sp, %d\n", imm, -imm);
+      break;
+    }
+    default: printf("  nop\n"); break;
+  }
+  return;
+reset_t0:
+  printf("  li t0, %d\n", rand_word());
+}
+
+int main(int argc, char *argv[]) {
+  int seed = time(0), n = 1000;
+  if (argc > 1) sscanf(argv[1], "%d", &seed);
+  if (argc > 2) sscanf(argv[2], "%d", &n);
+  srand(seed);
+
+  printf("# gen-rvc %d %d\n.globl _start\n_start:\n", seed, n);
+  printf("  li sp, 0x80020000\n  li s1, 0x80030000\n");
+  for (int i = 0; i < NR(reg); i ++) printf("  li %s, %d\n", reg[i], rand_word());
+  for (int i = 0; i < n; i ++) gen_inst();
+  printf("  li s1, 0x80010000\n");
+  for (int i = 1; i < 32; i ++) printf("  sw x%d, %d(s1)\n", i, (i - 1) * 4);
+  printf("  li a0, 0\n  ebreak\n");
+  return 0;
+}